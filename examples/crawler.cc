@@ -15,6 +15,7 @@
 #include <iostream>
 #include <fstream>
 #include <map> 
+#include <set>
 
 #include <regex>
 #include <locale>
@@ -48,16 +49,25 @@ typedef vertex<_float_type> vertex_type;
 using namespace std;
  
 
-const int DELAY = 10000;
 const std::string WRITE_DIR_PATH = "./";
 
 
 
 graph_type *the_graph;
-std::map<std::string, vertex_styled<_float_type> *> visited;
 std::set<std::string> visited_hostname;
 
-std::deque<std::pair<std::string, std::string> > worklist;
+// pages to fetch, with their vertices
+std::deque<std::tuple<std::string, std::string, vertex_type *> > worklist;
+
+// links of a fetched page, whose vertices are upserted by the layout thread
+struct crawled_page {
+    vertex_type *cv;
+    std::vector<std::pair<std::string, std::string> > links;
+    std::vector<std::string> keys;
+    std::shared_ptr<std::set<vertex_type *> > created;
+    std::future<std::pair<std::vector<vertex_type *>, size_t> > vs;
+};
+std::deque<crawled_page> pending;
 
 
 void to_lower(std::string &str)
@@ -151,18 +161,49 @@ std::string string_format(const char *fmt, ...) {
 }
  
  
+// follow the links of a page once their vertices are in the graph, the edges are
+// queued for the layout thread
+void follow(crawled_page &page)
+{
+    std::vector<vertex_type *> vs = page.vs.get().first;
+    graph_type::batch b;
+    for (size_t k = 0; k < page.links.size(); k++) {
+        auto e = new edge_styled<_float_type>(page.cv, vs[k]);
+        e->blendcolor = true;
+        if (page.created->erase(vs[k])) {
+            cout << "found link : " << page.keys[k] << endl;
+            worklist.push_back(std::make_tuple(
+                    page.links[k].first, page.links[k].second, vs[k]));
+        }
+        else {
+            e->strength = 0.01;
+        }
+        b.add_edge(e);
+    }
+    the_graph->post(std::move(b));
+}
+
+
 int connect(void)
 {
     std::string host, path;
-    while (!worklist.empty()) {
+    while (!worklist.empty() or !pending.empty()) {
+
+        // follow pages whose vertices are in the graph, wait for the layout thread
+        // only when there's nothing else to fetch
+        while (!pending.empty() and (worklist.empty() or 
+                pending.front().vs.wait_for(std::chrono::seconds(0)) == 
+                std::future_status::ready)) {
+            follow(pending.front());
+            pending.pop_front();
+        }
+        if (worklist.empty()) continue;
 
-        host = worklist.front().first;
-        path = worklist.front().second;
+        host = std::get<0>(worklist.front());
+        path = std::get<1>(worklist.front());
+        vertex_type *cv = std::get<2>(worklist.front());
         worklist.pop_front();
 
-        auto cv = visited[host + path];
-        assert(cv != nullptr);
-
         char cmd[4096];
         sprintf(cmd, "wget '%s%s' -t 1 -T 1 -O received", host.c_str(), path.c_str());
         system("rm -f received");
@@ -185,7 +226,9 @@ int connect(void)
             std::sregex_token_iterator i(s.begin(), s.end(), re, subs);
             std::sregex_token_iterator j;
             
-            color_type c = color_type(rand_range(0,1), rand_range(0,1), rand_range(0,1));
+            crawled_page crawled;
+            crawled.cv = cv;
+            crawled.created = std::make_shared<std::set<vertex_type *> >();
             for (; i != j; i++) {
                 // Iterate through the listed HREFs and
                 // move to next request //
@@ -202,57 +245,50 @@ int connect(void)
                         cout << "skip link : " << page->hostname << " page=" << hrefc  << endl;
                     }
                     else {
-                        if (visited.find(page->hostname + new_path) == visited.end()) {
-                            cout << "found link : " << page->hostname << " page=" << hrefc  << endl;
-                            usleep(DELAY);
-
-                            _float_type cx, cy, cz;
-                            cv->x.coord(cx, cy, cz);
-                            _float_type r = 5;
-                            auto v = new vertex_styled<_float_type>(
-                                rand_range(-r + cx, r + cx),
-                                rand_range(-r + cy, r + cy),
-                                rand_range(-r + cz, r + cz));
-
-                            // v->font_family = "/Library/Fonts/Courier New.ttf";
-                            // v->label = stringtowstring(new_path.substr(max((int)new_path.length() - 8, 0)));
-                            // v->font_size = 24;
-                            // v->size = 3;
-
-                            std::string actual_hostname = page->hostname.substr(0, page->hostname.find_first_of("/"));
-                            if (visited_hostname.find(actual_hostname) == visited_hostname.end()) {
-                                visited_hostname.insert(actual_hostname);
-                                v->font_family = "/Library/Fonts/Courier New.ttf";
-                                v->label = stringtowstring(actual_hostname);
-                                v->font_size = 24;
-                                v->size = 5;
-                            }
-                            else {
-                                v->size = 3;
-                            }
-
-                            v->color = c;
-                            visited[page->hostname + new_path] = v;
-                            the_graph->add_vertex(v);
-
-                            auto e = new edge_styled<_float_type>(cv, v);
-                            e->blendcolor = true;
-                            the_graph->add_edge(e);
-
-                            worklist.push_back(std::make_pair(page->hostname, new_path));
-                        }
-                        else {
-                            auto v2 = visited[page->hostname + new_path];
-                            auto e = new edge_styled<_float_type>(cv, v2);
-                            e->strength = 0.01;
-                            e->blendcolor = true;
-                            the_graph->add_edge(e);
-                        }
+                        crawled.links.push_back(std::make_pair(page->hostname, new_path));
+                        crawled.keys.push_back(page->hostname + new_path);
                     }
                     delete page;
 
                 }
             }
+
+            // pages seen for the first time are added (keyed by their url) by one
+            // upsert, which is queued for the layout thread like the edges
+            color_type c = color_type(rand_range(0,1), rand_range(0,1), rand_range(0,1));
+            auto created = crawled.created;
+            auto make = [c, cv, created](const std::string &key) {
+                _float_type cx, cy, cz;
+                cv->x.coord(cx, cy, cz);
+                _float_type r = 5;
+                auto v = new vertex_styled<_float_type>(
+                    rand_range(-r + cx, r + cx),
+                    rand_range(-r + cy, r + cy),
+                    rand_range(-r + cz, r + cz));
+
+                // v->font_family = "/Library/Fonts/Courier New.ttf";
+                // v->label = stringtowstring(new_path.substr(max((int)new_path.length() - 8, 0)));
+                // v->font_size = 24;
+                // v->size = 3;
+
+                std::string actual_hostname = key.substr(0, key.find_first_of("/"));
+                if (visited_hostname.find(actual_hostname) == visited_hostname.end()) {
+                    visited_hostname.insert(actual_hostname);
+                    v->font_family = "/Library/Fonts/Courier New.ttf";
+                    v->label = stringtowstring(actual_hostname);
+                    v->font_size = 24;
+                    v->size = 5;
+                }
+                else {
+                    v->size = 3;
+                }
+
+                v->color = c;
+                created->insert(v);
+                return v;
+            };
+            crawled.vs = the_graph->post_upsert_vertices(crawled.keys, make);
+            pending.push_back(std::move(crawled));
         } catch (std::regex_error& e) {
             cout << "Error: " << e.what() << "\n";
         }
@@ -284,7 +320,7 @@ int main(int argc, char *argv[])
     cout << "Launching program" << endl;
     GLFWwindow *window = galaster_init();
     if (window) {
-        the_graph = new graph_type(1, 
+        the_graph = new graph_type(0,   // automatic depth
             250,                    // f0
             0.02,                   // K
             0.001,                  // eps
@@ -298,9 +334,9 @@ int main(int argc, char *argv[])
         v->font_size = 24;
         v->size = 5;
         v->color = color_type::green;
-        visited[host + path] = v;
         the_graph->add_vertex(v);
-        worklist.push_back(std::make_pair(host, path));
+        the_graph->set_key(v, host + path);
+        worklist.push_back(std::make_tuple(host, path, v));
         visited_hostname.insert(host);
 
         glfwSetKeyCallback(window, key_callback);
@@ -0,0 +1,170 @@
+#ifndef _COARSENING_H_
+#define _COARSENING_H_
+
+
+#include <algorithm>
+#include <vector>
+
+
+// 
+// Topology of a layer in terms of vertex indices, so that the coarsening of a layer
+// can be planned without touching the vertex and edge objects of the graph (e.g. by
+// a background thread while the graph is being mutated). Each edge object of the
+// layer is listed once, as a directed edge from a to b connected cnt times
+// 
+struct layer_topology
+{
+    struct edge_rec {
+        long a, b;
+        int cnt;
+        float strength;
+    };
+
+    long n = 0;
+    std::vector<edge_rec> es;
+};
+
+
+// 
+// One level of coarsening: coarse[i] is the index of the coarser vertex of vertex
+// i, and topology is the topology of the coarser layer
+// 
+struct coarsening
+{
+    std::vector<long> coarse;
+    layer_topology topology;
+
+    // ratio of the number of coarser vertices to the number of finer vertices
+    double ratio(void) const {
+        return coarse.empty()? 1: (double) topology.n / coarse.size();
+    }
+
+    // largest number of finer vertices contracted into one coarser vertex
+    size_t max_size(void) const {
+        std::vector<size_t> size(topology.n, 0);
+        size_t m = 0;
+        for (long c : coarse) m = std::max(m, ++size[c]);
+        return m;
+    }
+};
+
+
+// 
+// Heavy-edge matching of vertices of a layer, in rounds of parallel proposals: each
+// unmatched vertex proposes to the neighbour with the heaviest edge among unmatched
+// ones (ties are broken by a hash of the edge), and mutual proposals are matched.
+// Returns the mate of each vertex, or -1 for unmatched vertices
+// 
+inline std::vector<long> match_heavy_edges(const layer_topology &t, int max_rounds)
+{
+    long n = t.n;
+    auto hash = [](long i, long j) {
+        if (i > j) std::swap(i, j);
+        unsigned long long h = ((unsigned long long) i << 32) ^ j;
+        h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+        return h ^ (h >> 31);
+    };
+
+    // incident edges of vertex i are t.es[inc[first[i], first[i + 1])]
+    std::vector<long> first(n + 1, 0), inc;
+    for (auto &e : t.es) {
+        first[e.a + 1] += 1;
+        if (e.a != e.b) first[e.b + 1] += 1;
+    }
+    for (long i = 0; i < n; i++) first[i + 1] += first[i];
+    inc.resize(first[n]);
+    std::vector<long> fill(first.begin(), first.end() - 1);
+    for (long k = 0; k < (long) t.es.size(); k++) {
+        inc[fill[t.es[k].a]++] = k;
+        if (t.es[k].a != t.es[k].b) inc[fill[t.es[k].b]++] = k;
+    }
+
+    std::vector<long> mate(n, -1), proposal(n, -1);
+    for (int round = 0; round < max_rounds; round++) {
+#pragma omp parallel for schedule(dynamic, 256)
+        for (long i = 0; i < n; i++) {
+            proposal[i] = -1;
+            if (mate[i] >= 0) continue;
+            float w_best = 0;
+            for (long p = first[i]; p < first[i + 1]; p++) {
+                const layer_topology::edge_rec &e = t.es[inc[p]];
+                long j = (e.a == i)? e.b: e.a;
+                if (j == i or mate[j] >= 0) continue;
+                float w = e.strength * e.cnt;
+                if (proposal[i] < 0 or w > w_best or
+                    (w == w_best and hash(i, j) < hash(i, proposal[i]))) {
+                    proposal[i] = j;
+                    w_best = w;
+                }
+            }
+        }
+        long n_matched = 0;
+#pragma omp parallel for reduction(+: n_matched)
+        for (long i = 0; i < n; i++) {
+            long j = proposal[i];
+            if (j >= 0 and proposal[j] == i) {
+                mate[i] = j;
+                n_matched += 1;
+            }
+        }
+        if (n_matched == 0) break;
+    }
+    return mate;
+}
+
+
+// 
+// Contract vertices of a layer into m coarser vertices, vertex i into coarse[i].
+// The outgoing edges of a coarser vertex sum up the outgoing edges of its finer
+// vertices, just like the edges layer::match() would rewire when the edges were
+// added one by one
+// 
+inline coarsening contract(const layer_topology &t, std::vector<long> coarse, long m)
+{
+    coarsening c;
+    c.coarse = std::move(coarse);
+    c.topology.n = m;
+
+    // outgoing edges of coarser vertex k are t.es[out[first[k], first[k + 1])]
+    std::vector<long> first(m + 1, 0), out(t.es.size());
+    for (auto &e : t.es) first[c.coarse[e.a] + 1] += 1;
+    for (long k = 0; k < m; k++) first[k + 1] += first[k];
+    std::vector<long> fill(first.begin(), first.end() - 1);
+    for (long k = 0; k < (long) t.es.size(); k++) out[fill[c.coarse[t.es[k].a]]++] = k;
+
+    std::vector<std::vector<layer_topology::edge_rec>> es(m);
+#pragma omp parallel for schedule(dynamic, 256)
+    for (long k = 0; k < m; k++) {
+        std::vector<std::pair<long, int>> targets;
+        for (long p = first[k]; p < first[k + 1]; p++) {
+            const layer_topology::edge_rec &e = t.es[out[p]];
+            targets.push_back({ c.coarse[e.b], e.cnt });
+        }
+        std::sort(targets.begin(), targets.end());
+        for (size_t q = 0; q < targets.size(); q++) {
+            if (q == 0 or targets[q].first != targets[q - 1].first)
+                es[k].push_back(layer_topology::edge_rec { k, targets[q].first, 0, 1 });
+            es[k].back().cnt += targets[q].second;
+        }
+    }
+    for (auto &e : es) c.topology.es.insert(c.topology.es.end(), e.begin(), e.end());
+    return c;
+}
+
+
+// plan the coarsening of a layer by matching and contracting its vertices
+inline coarsening plan_coarsening(const layer_topology &t, int max_rounds)
+{
+    std::vector<long> mate = match_heavy_edges(t, max_rounds);
+    std::vector<long> coarse(t.n);
+    long m = 0;
+    for (long i = 0; i < t.n; i++) {
+        if (mate[i] >= 0 and mate[i] < i) coarse[i] = coarse[mate[i]];
+        else coarse[i] = m++;
+    }
+    return contract(t, std::move(coarse), m);
+}
+
+
+#endif /* _COARSENING_H_ */
@@ -0,0 +1,510 @@
+#ifndef _DISTRIBUTED_H_
+#define _DISTRIBUTED_H_
+
+
+#include "graph.hh"
+#include "layout.hh"
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <signal.h>
+#include <unistd.h>
+#include <memory>
+#include <new>
+#include <stdexcept>
+
+
+// 
+// Layout of the finest layer of a graph with several local processes. Each process
+// owns a spatial domain given by recursive coordinate bisection of the positions of
+// vertices, and moves the vertices in it.
+// 
+// State of vertices is kept in shared memory indexed by vertex, so that the halo is
+// exchanged by reading the positions of neighbours owned by other processes, and a
+// vertex migrates to another domain by changing its owner when domains are
+// rebalanced. After moving its vertices, each process publishes a summary of its
+// domain: the cells of a uniform grid with 2^depth cells per axis (the top levels of
+// an octree over the domain) with their masses, centroids and member vertices. Other
+// processes take a cell as a point mass if it's far enough, and repel the vertices in
+// the cell one by one otherwise. Repulsion within a domain uses the backend selected
+// for its size by the cost model of the graph, as in graph::layout.
+// 
+// Unlike graph::layout, coarser layers are not used, spline edges act as straight
+// springs and components are not packed. Processes are forked by run(), so the graph
+// must not be mutated by other threads while it runs.
+// 
+template <typename _coord_type, int _dim = 3,
+          typename _force_model = spring_electrical>
+class distributed_layout
+{
+public:
+    typedef _coord_type float_type;
+    typedef vector3d<_coord_type, _dim> vector3d_type;
+    typedef vertex<_coord_type, _dim> vertex_type;
+    typedef graph<_coord_type, _dim, _force_model> graph_type;
+
+    distributed_layout(graph_type *g, int n_procs, int depth = (_dim == 3)? 3: 4)
+        : g(g), n_procs(std::max(n_procs, 1)), depth(depth),
+          n_cells(1 << (_dim * depth)) {
+    }
+    distributed_layout(const distributed_layout &) = delete;
+
+    // migrate vertices between domains every rebalance_interval iterations
+    int rebalance_interval = 10;
+
+    // 
+    // Run `iterations` iterations of layout with time step dt, and write positions
+    // back to the graph. Returns the maximum acceleration in the last iteration
+    // 
+    double run(int iterations, float_type dt)
+    {
+        write_lock_guard l(g->lock);
+        g->registry.ensure_calibrated();
+        auto layer = g->g;
+        f0 = layer->f0;
+        K = layer->K;
+        eps = layer->eps;
+        damping = layer->damping;
+        snapshot();
+        bisect(0, n_active, 0, n_procs);
+
+        std::vector<pid_t> pids;
+        for (int rank = 0; rank < n_procs; rank++) {
+            pid_t pid = fork();
+            if (pid == 0) {
+                worker(rank, iterations, dt);
+                _exit(0);
+            }
+            if (pid < 0) {
+                for (auto p : pids) kill(p, SIGKILL);
+                for (auto p : pids) waitpid(p, nullptr, 0);
+                release();
+                throw std::runtime_error("distributed_layout: fork failed");
+            }
+            pids.push_back(pid);
+        }
+
+        bool failed = false;
+        for (auto pid : pids) {
+            int status = 0;
+            waitpid(pid, &status, 0);
+            failed = failed or !WIFEXITED(status) or WEXITSTATUS(status) != 0;
+        }
+        if (failed) {
+            release();
+            throw std::runtime_error("distributed_layout: worker failed");
+        }
+
+        double max_ddx = 0;
+        for (int rank = 0; rank < n_procs; rank++)
+            max_ddx = std::max(max_ddx, shm_max_ddx[rank]);
+        write_back();
+        release();
+        return max_ddx;
+    }
+
+private:
+    // a cell of the grid summarizing a domain, member vertices of the cell are
+    // order[first, last)
+    struct cell_type {
+        vector3d_type c;            // mass-weighted sum of positions
+        float_type mass;
+        float_type rl;              // reciprocal of the diagonal of the cell
+        size_t first, last;
+    };
+
+    // spring to vertex j, oriented is 1 (-1) if the spring pulls upwards (downwards)
+    struct adjacency_type {
+        size_t j;
+        float_type strength;
+        int oriented;
+    };
+
+    // vertex in the domain of a process, whose mass is taken from the graph
+    typedef repulsion_proxy<_coord_type, _dim> proxy_type;
+
+    // allocate an array of count objects from the shared memory segment
+    template <typename T>
+    T *carve(size_t count) {
+        size_t offset = (shm_size + 63) & ~(size_t) 63;
+        shm_size = offset + count * sizeof(T);
+        return reinterpret_cast<T *>(offset);
+    }
+
+    template <typename T>
+    void relocate(T *&p) {
+        p = reinterpret_cast<T *>(shm + reinterpret_cast<size_t>(p));
+    }
+
+    // copy state of active vertices of the finest layer into shared memory
+    void snapshot(void)
+    {
+        vs.clear();
+        index.clear();
+        for (auto v : g->g->vs) {
+            if (v->active) {
+                index[v] = vs.size();
+                vs.push_back(v);
+            }
+        }
+        n_active = vs.size();
+
+        adj_first.assign(1, 0);
+        adj.clear();
+        for (auto v : vs) {
+            for (auto e : v->es) {
+                vertex_type *v2 = (e->a == v)? e->b: e->a;
+                auto p = index.find(v2);
+                if (v2 == v or p == index.end()) continue;
+                int oriented = !e->oriented? 0: (e->a == v)? 1: -1;
+                adj.push_back(adjacency_type { p->second, e->strength, oriented });
+            }
+            adj_first.push_back(adj.size());
+        }
+
+        shm_size = 0;
+        barrier = carve<pthread_barrier_t>(1);
+        x = carve<vector3d_type>(n_active);
+        dx = carve<vector3d_type>(n_active);
+        ddx = carve<vector3d_type>(n_active);
+        mass = carve<float_type>(n_active);
+        pinned = carve<char>(n_active);
+        order = carve<size_t>(n_active);
+        rank_first = carve<size_t>(n_procs + 1);
+        cells = carve<cell_type>((size_t) n_procs * n_cells);
+        shm_max_ddx = carve<double>(n_procs);
+
+        void *p = mmap(nullptr, shm_size, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED) throw std::bad_alloc();
+        shm = static_cast<char *>(p);
+        relocate(barrier);
+        relocate(x);
+        relocate(dx);
+        relocate(ddx);
+        relocate(mass);
+        relocate(pinned);
+        relocate(order);
+        relocate(rank_first);
+        relocate(cells);
+        relocate(shm_max_ddx);
+
+        pthread_barrierattr_t attr;
+        pthread_barrierattr_init(&attr);
+        pthread_barrierattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+        pthread_barrier_init(barrier, &attr, n_procs);
+        pthread_barrierattr_destroy(&attr);
+
+        for (size_t i = 0; i < n_active; i++) {
+            vertex_type *v = vs[i];
+            new (&x[i]) vector3d_type(v->x);
+            new (&dx[i]) vector3d_type(v->dx);
+            new (&ddx[i]) vector3d_type(v->ddx);
+            mass[i] = _force_model::mass(v);
+            pinned[i] = v->pinned;
+            order[i] = i;
+        }
+        for (int rank = 0; rank < n_procs; rank++) shm_max_ddx[rank] = 0;
+    }
+
+    void release(void)
+    {
+        if (!shm) return;
+        pthread_barrier_destroy(barrier);
+        munmap(shm, shm_size);
+        shm = nullptr;
+    }
+
+    // copy positions back into the graph, vertices of coarser layers and centroids
+    // of spline edges are moved to the centers of the vertices they stand for
+    void write_back(void)
+    {
+        for (size_t i = 0; i < n_active; i++) {
+            vs[i]->x = x[i];
+            vs[i]->dx = dx[i];
+            vs[i]->ddx = ddx[i];
+        }
+        g->g->generation += 1;
+        for (auto layer : g->layers) {
+            if (!layer->coarser) break;
+            std::unordered_map<vertex_type *, int> counts;
+            for (auto v : layer->vs) {
+                if (counts[v->coarser]++ == 0) v->coarser->x = vector3d_type::zero;
+                v->coarser->x += v->x;
+            }
+            for (auto &p : counts) p.first->x *= float_type(1.0 / p.second);
+        }
+        for (auto v : vs) {
+            for (auto e : v->es) {
+                auto e_styled = static_cast<edge_styled<_coord_type, _dim> *>(e);
+                if (e_styled->spline and e_styled->vspline)
+                    e_styled->vspline->x = float_type(0.5) * (e->a->x + e->b->x);
+            }
+        }
+    }
+
+    // 
+    // recursive coordinate bisection of vertices order[lo, hi) into domains of ranks
+    // [r0, r1), the number of vertices of a domain is proportional to its ranks
+    // 
+    void bisect(size_t lo, size_t hi, int r0, int r1)
+    {
+        if (r1 - r0 == 1) {
+            rank_first[r0] = lo;
+            rank_first[r0 + 1] = hi;
+            return;
+        }
+        int rm = (r0 + r1) / 2;
+        size_t mid = lo + (hi - lo) * (rm - r0) / (r1 - r0);
+        if (hi - lo > 1) {
+            float_type lo_c[3], hi_c[3];
+            bounds(lo, hi, lo_c, hi_c);
+            int axis = 0;
+            for (int k = 1; k < _dim; k++) {
+                if (hi_c[k] - lo_c[k] > hi_c[axis] - lo_c[axis]) axis = k;
+            }
+            std::nth_element(order + lo, order + mid, order + hi,
+                [this, axis](size_t i, size_t j) {
+                    return coord(i, axis) < coord(j, axis);
+                });
+        }
+        bisect(lo, mid, r0, rm);
+        bisect(mid, hi, rm, r1);
+    }
+
+    float_type coord(size_t i, int axis) const {
+        float_type c[3];
+        x[i].coord(c[0], c[1], c[2]);
+        return c[axis];
+    }
+
+    void bounds(size_t lo, size_t hi, float_type *lo_c, float_type *hi_c) const
+    {
+        for (int k = 0; k < 3; k++) lo_c[k] = hi_c[k] = 0;
+        for (size_t p = lo; p < hi; p++) {
+            float_type c[3];
+            x[order[p]].coord(c[0], c[1], c[2]);
+            for (int k = 0; k < 3; k++) {
+                lo_c[k] = (p == lo)? c[k]: std::min(lo_c[k], c[k]);
+                hi_c[k] = (p == lo)? c[k]: std::max(hi_c[k], c[k]);
+            }
+        }
+    }
+
+    // 
+    // Summarize the domain of rank: sort its vertices by grid cell and compute the
+    // mass and centroid of each cell
+    // 
+    void summarize(int rank)
+    {
+        size_t lo = rank_first[rank], hi = rank_first[rank + 1];
+        cell_type *cs = cells + (size_t) rank * n_cells;
+        for (int c = 0; c < n_cells; c++) {
+            cs[c].mass = 0;
+            cs[c].first = cs[c].last = lo;
+        }
+        if (lo == hi) return;
+
+        float_type lo_c[3], hi_c[3], size[3];
+        bounds(lo, hi, lo_c, hi_c);
+        int n_axis = 1 << depth;
+        for (int k = 0; k < 3; k++) size[k] = (hi_c[k] - lo_c[k]) / n_axis + 1e-6;
+        float_type rl = vector3d_type(size[0], size[1], size[2]).rmod();
+
+        std::vector<int> cell_of(hi - lo);
+        std::vector<size_t> counts(n_cells, 0);
+        for (size_t p = lo; p < hi; p++) {
+            float_type c[3];
+            x[order[p]].coord(c[0], c[1], c[2]);
+            int cell = 0;
+            for (int k = 0; k < _dim; k++) {
+                int ck = std::min((int) ((c[k] - lo_c[k]) / size[k]), n_axis - 1);
+                cell = cell * n_axis + ck;
+            }
+            cell_of[p - lo] = cell;
+            counts[cell] += 1;
+        }
+
+        std::vector<size_t> sorted(hi - lo);
+        size_t offset = lo;
+        for (int c = 0; c < n_cells; c++) {
+            cs[c].first = cs[c].last = offset;
+            cs[c].c = vector3d_type::zero;
+            cs[c].rl = rl;
+            offset += counts[c];
+        }
+        for (size_t p = lo; p < hi; p++) {
+            cell_type &cell = cs[cell_of[p - lo]];
+            size_t i = order[p];
+            sorted[cell.last++ - lo] = i;
+            cell.mass += mass[i];
+            cell.c += mass[i] * x[i];
+        }
+        std::copy(sorted.begin(), sorted.end(), order + lo);
+    }
+
+    // repulsion on vertex i exerted by the domain of another rank
+    vector3d_type remote_repulsion(size_t i, int rank) const
+    {
+        vector3d_type F = vector3d_type::zero;
+        float_type reps = 2 / sqrt(eps);
+        const cell_type *cs = cells + (size_t) rank * n_cells;
+        for (int c = 0; c < n_cells; c++) {
+            const cell_type &cell = cs[c];
+            if (cell.first == cell.last) continue;
+            auto d = x[i] - float_type(1 / cell.mass) * cell.c;
+            auto rdd = d.rmod();
+            if (rdd < cell.rl) {
+                F += _force_model::repulsion(f0 * mass[i] * cell.mass, rdd) * d;
+                continue;
+            }
+            for (size_t p = cell.first; p < cell.last; p++) {
+                size_t j = order[p];
+                auto dj = x[i] - x[j];
+                auto rddj = dj.rmod();
+                if (rddj <= reps)
+                    F += _force_model::repulsion(f0 * mass[i] * mass[j], rddj) * dj;
+            }
+        }
+        return F;
+    }
+
+    vector3d_type spring_force(size_t i) const
+    {
+        vector3d_type F = vector3d_type::zero;
+        for (size_t p = adj_first[i]; p < adj_first[i + 1]; p++) {
+            const adjacency_type &a = adj[p];
+            auto d = x[i] - x[a.j];
+            F -= _force_model::attraction(K, a.strength, d) * d;
+            if (a.oriented) {
+                float_type bias = _force_model::oriented_bias * a.oriented;
+                F += vector3d_type(0, bias, 0);
+            }
+        }
+        return F;
+    }
+
+    // main loop of the process laying out the domain of rank
+    void worker(int rank, int iterations, float_type dt)
+    {
+        typedef repulsion_domain<_coord_type, _dim> domain_type;
+
+        // backends for proxies, chosen with the cost model of the graph
+        repulsion_registry<_coord_type, _dim, proxy_model<_force_model>> registry;
+        registry.copy_coefficients(g->registry);
+
+        std::vector<vector3d_type> ddx_;
+        std::unique_ptr<proxy_type[]> proxies;
+        std::vector<vertex_type *> pproxies;
+        for (int it = 0; it < iterations; it++) {
+            size_t lo = rank_first[rank], hi = rank_first[rank + 1], n = hi - lo;
+
+            // move vertices of this domain
+            for (size_t p = lo; p < hi; p++) {
+                size_t i = order[p];
+                if (pinned[i]) continue;
+                vector3d_type delta = dx[i] * dt + (float_type(0.5) * dt * dt) * ddx[i];
+                delta.bound(3);
+                x[i] += delta;
+            }
+            pthread_barrier_wait(barrier);
+            summarize(rank);
+            pthread_barrier_wait(barrier);
+
+            // repulsion within this domain
+            if (pproxies.size() != n) {
+                proxies.reset(new proxy_type[n]);
+                pproxies.resize(n);
+                for (size_t k = 0; k < n; k++) pproxies[k] = &proxies[k];
+            }
+            domain_type d;
+            d.begin = pproxies.data();
+            d.end = pproxies.data() + n;
+            d.f0 = f0;
+            d.eps = eps;
+            d.state = nullptr;
+            for (size_t k = 0; k < n; k++) {
+                size_t i = order[lo + k];
+                proxies[k].x = x[i];
+                proxies[k].m = mass[i];
+            }
+            const repulsion_backend<_coord_type, _dim> *backend =
+                registry.backend(registry.select(n));
+            float_type lo_c[3], hi_c[3];
+            bounds(lo, hi, lo_c, hi_c);
+            d.x_min = lo_c[0]; d.x_max = hi_c[0];
+            d.y_min = lo_c[1]; d.y_max = hi_c[1];
+            d.z_min = lo_c[2]; d.z_max = hi_c[2];
+            if (n) backend->build(d);
+
+            // forces on vertices of this domain
+            double max_ddx = 0;
+            ddx_.resize(n, vector3d_type::zero);
+            for (size_t k = 0; k < n; k++) {
+                size_t i = order[lo + k];
+                if (pinned[i]) {
+                    ddx_[k] = vector3d_type::zero;
+                    continue;
+                }
+                vector3d_type F = backend->force(d, &proxies[k]);
+                for (int r = 0; r < n_procs; r++) {
+                    if (r != rank) F += remote_repulsion(i, r);
+                }
+                F += spring_force(i);
+                ddx_[k] = F;
+                max_ddx = std::max(max_ddx, (double) F.mod());
+            }
+            if (n) backend->release(d);
+
+            // update velocities
+            for (size_t k = 0; k < n; k++) {
+                size_t i = order[lo + k];
+                if (pinned[i]) {
+                    dx[i] = ddx[i] = vector3d_type::zero;
+                    continue;
+                }
+                dx[i] += float_type(0.5) * (ddx[i] + ddx_[k]) * dt;
+                dx[i] *= damping;
+                ddx[i] = ddx_[k];
+            }
+            shm_max_ddx[rank] = max_ddx;
+            pthread_barrier_wait(barrier);
+
+            // migrate vertices between domains
+            if ((it + 1) % rebalance_interval == 0 and it + 1 < iterations) {
+                if (rank == 0) bisect(0, n_active, 0, n_procs);
+                pthread_barrier_wait(barrier);
+            }
+        }
+    }
+
+
+    graph_type *g;
+    int n_procs;
+    int depth;
+    int n_cells;
+    float_type f0, K, eps, damping;
+
+    // active vertices of the finest layer, and springs among them
+    std::vector<vertex_type *> vs;
+    std::unordered_map<vertex_type *, size_t> index;
+    size_t n_active = 0;
+    std::vector<size_t> adj_first;
+    std::vector<adjacency_type> adj;
+
+    // shared memory segment, and arrays in it. Vertices of rank r are
+    // order[rank_first[r], rank_first[r + 1])
+    char *shm = nullptr;
+    size_t shm_size = 0;
+    pthread_barrier_t *barrier;
+    vector3d_type *x, *dx, *ddx;
+    float_type *mass;
+    char *pinned;
+    size_t *order;
+    size_t *rank_first;
+    cell_type *cells;
+    double *shm_max_ddx;
+};
+
+
+#endif /* _DISTRIBUTED_H_ */
@@ -0,0 +1,118 @@
+#ifndef _FORCE_MODEL_H_
+#define _FORCE_MODEL_H_
+
+
+#include "vertex_edge.hh"
+
+
+// 
+// Force model policies. Layers, octrees and repulsion backends are parameterized
+// on one of these types, so that the force kernels get inlined into the layout
+// loops. Each policy provides
+// 
+//   mass(v):                     weight of v in repulsion (and in octree cells)
+//   repulsion(f, rdd):           factor applied to dx = v - u for repulsion between
+//                                v and u, where f = f0 * mass(v) * mass(u) and
+//                                rdd = 1 / |dx|
+//   attraction(K, strength, dx): factor applied to -dx for the spring force of an
+//                                edge, where dx = v1 - v2
+//   oriented_bias:               y-bias pulling oriented edges downwards
+// 
+
+struct force_model_base
+{
+    template <typename _coord_type, int _dim>
+    static _coord_type mass(const vertex<_coord_type, _dim> *) {
+        return 1;
+    }
+
+    static constexpr double oriented_bias = 0.4;
+};
+
+
+// 
+// The original force law of galaster: inverse-square repulsion and linear springs
+// 
+struct spring_electrical : public force_model_base
+{
+    template <typename _coord_type>
+    static _coord_type repulsion(_coord_type f, _coord_type rdd) {
+        return f * (rdd * rdd * rdd);
+    }
+
+    template <typename _coord_type, int _dim>
+    static _coord_type attraction(
+        _coord_type K, _coord_type strength,
+        const vector3d<_coord_type, _dim> &) {
+        return K * strength;
+    }
+};
+
+
+// 
+// Fruchterman-Reingold: repulsion k^2 / d and attraction d^2 / k, with f0 playing
+// the role of k^2 and K the role of 1 / k
+// 
+struct fruchterman_reingold : public force_model_base
+{
+    template <typename _coord_type>
+    static _coord_type repulsion(_coord_type f, _coord_type rdd) {
+        return f * (rdd * rdd);
+    }
+
+    template <typename _coord_type, int _dim>
+    static _coord_type attraction(
+        _coord_type K, _coord_type strength,
+        const vector3d<_coord_type, _dim> &dx) {
+        return K * strength * dx.mod();
+    }
+};
+
+
+// 
+// LinLog energy model (Noack): repulsion 1 / d and logarithmic attraction, which
+// separates clusters more clearly than the spring-electrical model
+// 
+struct linlog : public force_model_base
+{
+    template <typename _coord_type>
+    static _coord_type repulsion(_coord_type f, _coord_type rdd) {
+        return f * (rdd * rdd);
+    }
+
+    template <typename _coord_type, int _dim>
+    static _coord_type attraction(
+        _coord_type K, _coord_type strength,
+        const vector3d<_coord_type, _dim> &dx) {
+        _coord_type d = dx.mod();
+        return d > 0? K * strength * log1p(d) / d: K * strength;
+    }
+};
+
+
+// 
+// ForceAtlas2: degree-weighted repulsion (deg(u) + 1)(deg(v) + 1) / d and linear
+// attraction, hubs push their surroundings further away
+// 
+struct force_atlas2 : public force_model_base
+{
+    template <typename _coord_type, int _dim>
+    static _coord_type mass(const vertex<_coord_type, _dim> *v) {
+        return _coord_type(v->es.size() + 1);
+    }
+
+    template <typename _coord_type>
+    static _coord_type repulsion(_coord_type f, _coord_type rdd) {
+        return f * (rdd * rdd);
+    }
+
+    template <typename _coord_type, int _dim>
+    static _coord_type attraction(
+        _coord_type K, _coord_type strength,
+        const vector3d<_coord_type, _dim> &) {
+        return K * strength;
+    }
+};
+
+
+#endif /* _FORCE_MODEL_H_ */
@@ -224,15 +224,22 @@ GLFWwindow *galaster_init(void)
     return window;
 }
 
-int galaster_run(GLFWwindow *window, graph_base *graph, double dt)
+int galaster_run(GLFWwindow *window, graph_base *graph, double dt,
+    const numa_config &config)
 {
     g_graph = graph;
+    numa_settings() = config;
 
-    // launch a worker thread for layout the graph
+    // launch a worker thread for layout the graph, OpenMP workers inherit the CPUs
+    // the layout thread is pinned to
     int n_processors = omp_get_num_procs();
+    int n_workers = config.layout_cpus.empty()? 
+        n_processors - 1: (int) config.layout_cpus.size();
     printf("Galaster: running on %d processors\n", n_processors);
     auto layout_thread = new std::thread([=]() {
-            omp_set_num_threads(n_processors - 1);
+            if (!numa_pin_thread(config.layout_cpus))
+                fprintf(stderr, "Galaster: failed to pin the layout thread\n");
+            omp_set_num_threads(std::max(n_workers, 1));
             double l_dt = dt;
             double t, dt_total, t_old;
             t_old = glfwGetTime() - 0.01;
@@ -248,6 +255,8 @@ int galaster_run(GLFWwindow *window, graph_base *graph, double dt)
         });
 
     // render the graph in current thread
+    if (!numa_pin_thread(config.render_cpus))
+        fprintf(stderr, "Galaster: failed to pin the render thread\n");
     while (!glfwWindowShouldClose(window))
     {
         draw_scene(window, graph);
@@ -12,7 +12,8 @@
 extern graph_base *g_graph;
 
 GLFWwindow *galaster_init(void);
-int galaster_run(GLFWwindow *window, graph_base *graph, double dt = 1.0);
+int galaster_run(GLFWwindow *window, graph_base *graph, double dt = 1.0,
+    const numa_config &config = numa_config());
 
 void galaster_key_callback(
     GLFWwindow* window, 
@@ -3,7 +3,13 @@
 
 
 #include "layer.hh"
+#include "mutation_queue.hh"
 #include "rwlock.hh"
+#include <condition_variable>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
 
 
 class graph_base {
@@ -18,41 +24,61 @@ public:
         GLfloat &z_min, GLfloat &z_max) = 0;
 };
 
-template <typename _coord_type>
+// 
+// A graph laid out with multilevel force-directed method. The force law is given
+// by the force model policy, see force_model.hh
+// 
+template <typename _coord_type, int _dim = 3,
+          typename _force_model = spring_electrical>
 class graph : public graph_base
 {
 public:
     typedef _coord_type float_type;
-    typedef vector3d<_coord_type> vector3d_type;
-    typedef layer<_coord_type> layer_type;
-    typedef vertex<_coord_type> vertex_type;
-    typedef edge<_coord_type> edge_type;
+    typedef _force_model force_model;
+    typedef vector3d<_coord_type, _dim> vector3d_type;
+    typedef layer<_coord_type, _dim, _force_model> layer_type;
+    typedef vertex<_coord_type, _dim> vertex_type;
+    typedef edge<_coord_type, _dim> edge_type;
 
+    // 
+    // A graph with n_layers layers, or with automatic depth if n_layers is not
+    // positive (see adjust_depth)
+    // 
     graph(int n_layers, 
         double f0, double K, double eps, double damping, double dilation)
+        : f0(f0), K(K), eps(eps), damping(damping), dilation(dilation),
+          auto_depth(n_layers <= 0)
     {
+        n_layers = std::max(n_layers, 1);
         layers.reserve(n_layers);
-        layers.push_back(new finest_layer<_coord_type>(
+        layers.push_back(new finest_layer<_coord_type, _dim, _force_model>(
                 f0, K, eps, damping, dilation));
         for (int k = 1; k < n_layers; k++)
             layers.push_back(new layer_type(f0, K, eps, damping, dilation));
 
         for (int k = 1; k < n_layers; k++)
             layers[k - 1]->coarser = layers[k];
+        for (auto layer : layers) layer->registry = &registry;
 
         g = layers[0];
     }
     graph(const graph &) = delete;
 
     ~graph(void) {
+        stop_reoptimizer();
+        apply_posted();
+
         // remove all vertices (and edges) in this graph before disposing all layers
+        clear();
+        for (auto layer : layers) delete layer;
+    }
+
+    // remove and delete all vertices and edges of this graph
+    void clear(void) {
         write_lock_guard l(lock);
         auto vs = g->vs;
-        for (auto v : vs) {
-            g->remove_vertex(v);
-            delete v;
-        }
-        for (auto layer : layers) delete layer;
+        g->clear();
+        for (auto v : vs) delete v;
     }
 
     // 
@@ -67,6 +93,14 @@ public:
         write_lock_guard l(lock);
         g->remove_vertex(v); 
     }
+    vertex_handle handle(const vertex_type *v) {
+        read_lock_guard l(lock);
+        return g->handle(v);
+    }
+    vertex_type *get(vertex_handle h) {
+        read_lock_guard l(lock);
+        return g->get(h);
+    }
     edge_type *add_edge(edge_type *e) {
         write_lock_guard l(lock);
         return g->add_edge(e);
@@ -76,16 +110,540 @@ public:
         g->remove_edge(e);
     }
 
+    // 
+    // Index of vertices by external keys, 64-bit integers or strings, so that
+    // producers don't keep maps of their own. A vertex has at most one key, setting
+    // a key takes it from the vertex it named before, and the key of a vertex is
+    // dropped as the vertex is removed
+    // 
+    template <typename _key_type>
+    void set_key(vertex_type *v, const _key_type &key) {
+        write_lock_guard l(lock);
+        finest()->keys.bind(key, g->handle(v));
+    }
+    // vertex of key, or nullptr
+    template <typename _key_type>
+    vertex_type *find_vertex(const _key_type &key) {
+        read_lock_guard l(lock);
+        return g->get(finest()->keys.find(key));
+    }
+    // vertices of keys, nullptr for unknown keys
+    template <typename _key_type>
+    void find_vertices(const std::vector<_key_type> &keys, std::vector<vertex_type *> &vs)
+    {
+        read_lock_guard l(lock);
+        std::vector<vertex_handle> hs(keys.size());
+        finest()->keys.find(keys.data(), keys.size(), hs.data());
+        vs.resize(keys.size());
+        for (size_t i = 0; i < keys.size(); i++) vs[i] = g->get(hs[i]);
+    }
+    // 
+    // vertices of keys, vertices of unknown keys are created by make(key) and added
+    // with their keys, under one write lock. make must not call the locking
+    // interface of the graph. Returns the number of vertices added
+    // 
+    template <typename _key_type, typename _make_type>
+    size_t upsert_vertices(
+        const std::vector<_key_type> &keys, std::vector<vertex_type *> &vs,
+        _make_type make)
+    {
+        write_lock_guard l(lock);
+        return upsert(keys, vs, make);
+    }
+
+    // 
+    // upsert_vertices posted like post(), so that producers don't wait for the lock.
+    // Keys are looked up, and make is called, by the layout thread before its next
+    // iteration. The returned future holds the vertices of keys and the number of
+    // vertices added, and is ready once they are in the graph. As for
+    // upsert_vertices, make must not call the locking interface of the graph
+    // 
+    template <typename _key_type, typename _make_type>
+    std::future<std::pair<std::vector<vertex_type *>, size_t>> post_upsert_vertices(
+        std::vector<_key_type> keys, _make_type make)
+    {
+        typedef std::pair<std::vector<vertex_type *>, size_t> result_type;
+        struct upsert_type {
+            std::vector<_key_type> keys;
+            result_type result;
+            std::promise<result_type> promise;
+        };
+        auto p = std::make_shared<upsert_type>();
+        p->keys = std::move(keys);
+        auto f = p->promise.get_future();
+        mutations.push(
+            [this, p, make]() mutable {
+                p->result.second = upsert(p->keys, p->result.first, make);
+            },
+            [p]() { p->promise.set_value(std::move(p->result)); });
+        return f;
+    }
+
+    // 
+    // Add a complete set of vertices and (not refcounted) edges at once. Layers of
+    // an empty graph are built in parallel bottom up, otherwise they're added one by
+    // one. Edges must not be used after being added
+    // 
+    void add_bulk(
+        const std::vector<vertex_type *> &vs,
+        const std::vector<edge_type *> &es)
+    {
+        write_lock_guard l(lock);
+        if (g->vs.empty()) {
+            g->add_bulk(vs, es);
+            return;
+        }
+        for (auto v : vs) g->add_vertex(v);
+        for (auto e : es) g->add_edge(e);
+    }
+
+    // 
+    // A batch of mutations, applied by apply() in the order they were recorded. Like
+    // add_edge, edges recorded in a batch are not refcounted (styled) edges, so they
+    // can be used after the batch is applied
+    // 
+    class batch
+    {
+    public:
+        void add_vertex(vertex_type *v) { ops.push_back({ op_type::add_vertex, v }); }
+        void remove_vertex(vertex_type *v) {
+            ops.push_back({ op_type::remove_vertex, v });
+        }
+        void add_edge(edge_type *e) { ops.push_back({ op_type::add_edge, nullptr, e }); }
+        void remove_edge(edge_type *e) {
+            ops.push_back({ op_type::remove_edge, nullptr, e });
+        }
+
+        size_t size(void) const { return ops.size(); }
+        bool empty(void) const { return ops.empty(); }
+        void clear(void) { ops.clear(); }
+
+    protected:
+        friend class graph;
+
+        enum class op_type { add_vertex, remove_vertex, add_edge, remove_edge };
+        struct op {
+            op_type type;
+            vertex_type *v;
+            edge_type *e;
+        };
+        std::vector<op> ops;
+    };
+
+    // 
+    // Apply a batch of mutations under one write lock. Matched components affected
+    // by the removed edges are split at the end of the batch (see layer::begin_batch)
+    // 
+    void apply(const batch &b) {
+        write_lock_guard l(lock);
+        g->begin_batch();
+        replay(b);
+        g->end_batch();
+    }
+    void add_vertices(const std::vector<vertex_type *> &vs) {
+        write_lock_guard l(lock);
+        for (auto v : vs) g->add_vertex(v);
+    }
+    void add_edges(const std::vector<edge_type *> &es) {
+        write_lock_guard l(lock);
+        for (auto e : es) g->add_edge(e);
+    }
+
+    // 
+    // Post a batch of mutations, or a function mutating the graph (e.g. restyling
+    // vertices and edges), from any thread without waiting for the lock. Posted
+    // mutations are applied in the order they were posted by the layout thread before
+    // its next iteration, all in one batch. The returned future is ready (or done is
+    // called, on the layout thread) once the mutation is applied. Functions are
+    // called with the graph locked for writing, they must not call the locking
+    // interface of the graph
+    // 
+    std::future<void> post(batch b) {
+        auto p = std::make_shared<batch>(std::move(b));
+        return mutations.push([this, p]() { replay(*p); });
+    }
+    void post(batch b, std::function<void(void)> done) {
+        auto p = std::make_shared<batch>(std::move(b));
+        mutations.push([this, p]() { replay(*p); }, std::move(done));
+    }
+    std::future<void> post(std::function<void(void)> f) {
+        return mutations.push(std::move(f));
+    }
+    void post(std::function<void(void)> f, std::function<void(void)> done) {
+        mutations.push(std::move(f), std::move(done));
+    }
+
+    // apply posted mutations now, returns the number of mutations applied
+    size_t apply_posted(void) {
+        if (mutations.empty()) return 0;
+        return mutations.consume([this](const std::function<void(void)> &run) {
+                write_lock_guard l(lock);
+                g->begin_batch();
+                run();
+                g->end_batch();
+            });
+    }
+
+    // 
+    // Remove vertices and edges whose time to live (see vertex_styled::ttl and
+    // edge_styled::ttl) has run out, in one batch. Expired vertices are deleted by the
+    // graph. Called by layout() before each iteration, returns the number of vertices
+    // and edges removed
+    // 
+    size_t expire(void) {
+        auto finest = static_cast<finest_layer<_coord_type, _dim, _force_model> *>(g);
+        {
+            read_lock_guard l(lock);
+            if (!finest->expiry_pending()) return 0;
+        }
+        std::vector<vertex_type *> vs;
+        std::vector<edge_type *> es;
+        write_lock_guard l(lock);
+        finest->collect_expired(vs, es);
+        if (vs.empty() and es.empty()) return 0;
+        g->begin_batch();
+        // edges go first, removing a vertex deletes its edges
+        for (auto e : es) g->remove_edge(e);
+        for (auto v : vs) g->remove_vertex(v);
+        g->end_batch();
+        for (auto v : vs) delete v;
+        return vs.size() + es.size();
+    }
+
+    // pin v at its current position, or release it
+    void set_pinned(vertex_type *v, bool pinned) {
+        write_lock_guard l(lock);
+        v->pinned = pinned;
+    }
+    // strength of an edge in the graph. Parallel edges share one spring which sums
+    // their strengths as they are added, so e->strength must not be changed directly
+    void set_strength(edge_type *e, float_type strength) {
+        write_lock_guard l(lock);
+        finest()->set_strength(e, strength);
+    }
+    // include v in (or exclude v from) the layout, v is kept in the graph
+    void set_active(vertex_type *v, bool active) {
+        write_lock_guard l(lock);
+        if (active and !v->active) {
+            v->dx = v->ddx = v->ddx_ = vector3d_type::zero;
+        }
+        v->active = active;
+        g->generation += 1;
+    }
+
+    // 
+    // Restrict layout to a region of interest: the vertices within `hops` edges of
+    // the seeds, or the vertices inside a box. Vertices outside of the region are
+    // frozen until clear_focus() is called, the per-iteration cost only depends on
+    // the size of the region
+    // 
+    void set_focus(const std::vector<vertex_type *> &seeds, int hops)
+    {
+        write_lock_guard l(lock);
+        std::vector<vertex_type *> region;
+        std::unordered_set<vertex_type *> visited;
+        for (auto v : seeds) {
+            if (visited.insert(v).second) region.push_back(v);
+        }
+        size_t first = 0;
+        for (int k = 0; k < hops; k++) {
+            size_t last = region.size();
+            for (size_t i = first; i < last; i++) {
+                for (auto e : region[i]->es) {
+                    vertex_type *v2 = (e->a == region[i])? e->b: e->a;
+                    if (v2->active and visited.insert(v2).second)
+                        region.push_back(v2);
+                }
+            }
+            first = last;
+        }
+        g->set_focus(region);
+    }
+
+    void set_focus(
+        float_type x_min, float_type x_max,
+        float_type y_min, float_type y_max,
+        float_type z_min, float_type z_max)
+    {
+        write_lock_guard l(lock);
+        std::vector<vertex_type *> region;
+        for (auto v : g->vs) {
+            _coord_type x, y, z;
+            v->x.coord(x, y, z);
+            if (x >= x_min and x <= x_max and 
+                y >= y_min and y <= y_max and
+                z >= z_min and z <= z_max) region.push_back(v);
+        }
+        g->set_focus(region);
+    }
+
+    void clear_focus(void)
+    {
+        write_lock_guard l(lock);
+        g->clear_focus();
+    }
+
+    // 
+    // Switch centroids of spline edges to the lightweight mode (local repulsion only,
+    // moved every `interval` iterations), or back to full physics
+    // 
+    void set_spline_light(bool light, int interval = 1)
+    {
+        write_lock_guard l(lock);
+        auto finest = static_cast<finest_layer<_coord_type, _dim, _force_model> *>(g);
+        finest->spline_light = light;
+        finest->spline_interval = std::max(interval, 1);
+    }
+
     std::vector<vertex_type *> &vertex_list(void) { return g->vs; }
 
+    // 
+    // Layers are laid out together by one OpenMP team. Moving vertices and updating
+    // velocities are done by all threads of the team, each on its own range of the
+    // state of every layer, so that a thread keeps handling the memory it first
+    // touched. Collecting vertices, building spatial indices and computing forces
+    // of a layer don't depend on other layers, and run as tasks in between. Only
+    // updating velocities needs the accelerations of the coarser layer, so
+    // velocities are updated from the coarsest layer down. Coarse layers smaller
+    // than batch_vertices are indexed one after another in a single task
+    // 
     virtual double layout(double dt)
     {
+        apply_posted();
+        expire();
+        if (auto_depth) adjust_depth();
+        install_reoptimized();
         read_lock_guard l(lock);
-        double max_ddx = 0;
-        for (auto i = layers.rbegin(); i != layers.rend(); ++i) {
-            max_ddx = (*i)->layout((float_type) dt);
+        float_type t = (float_type) dt;
+
+        // only the region of interest of the finest layer is laid out while the
+        // focus is set, coarser layers are left alone
+        if (g->focused()) return g->layout(t);
+
+        registry.ensure_calibrated();
+        for (auto layer : layers) layer->propagate_flags();
+
+        size_t n_layers = layers.size();
+        size_t k_small = n_layers;
+        while (k_small > 1 and layers[k_small - 1]->vs.size() < batch_vertices)
+            k_small--;
+
+        std::vector<_coord_type> max_ddx(n_layers, 0);
+#pragma omp parallel
+        {
+#pragma omp single
+            for (size_t k = 0; k < n_layers; k++) {
+#pragma omp task
+                layers[k]->layout_collect();
+            }
+            for (auto layer : layers) layer->layout_move(t);
+#pragma omp barrier
+#pragma omp single
+            {
+                if (k_small < n_layers) {
+#pragma omp task
+                    for (size_t k = n_layers; k-- > k_small; ) {
+                        layers[k]->layout_index();
+                        max_ddx[k] = layers[k]->layout_forces(t);
+                        layers[k]->layout_release();
+                    }
+                }
+                for (size_t k = 0; k < k_small; k++) {
+#pragma omp task
+                    {
+                        layers[k]->layout_index();
+                        max_ddx[k] = layers[k]->layout_forces(t);
+                        layers[k]->layout_release();
+                    }
+                }
+            }
+            for (size_t k = n_layers; k-- > 0; ) {
+                layers[k]->layout_velocity(t);
+#pragma omp barrier
+            }
         }
-        return max_ddx;
+        return max_ddx[0];
+    }
+
+    // 
+    // Add or drop coarse layers so that the hierarchy tracks the size of the graph.
+    // A layer is added on top of the coarsest layer while it has more than
+    // target_coarsest vertices, and is kept if it has at most min_coarsening times
+    // the vertices of its finer layer. The coarsest layer is dropped when its finer
+    // layer has shrunk below half of target_coarsest, or when it no longer
+    // coarsens by more than half of the required amount. A layer that was
+    // rejected isn't tried again until its finer layer has doubled in size.
+    // Depth is only checked when layers have changed, which is tracked by their
+    // generations. The check only takes the read lock, so that layout doesn't wait
+    // for readers (such as the render thread) when nothing has changed
+    // 
+    void adjust_depth(void)
+    {
+        {
+            read_lock_guard l(lock);
+            if (layers_generation() == depth_generation) return;
+        }
+
+        write_lock_guard l(lock);
+
+        while (layers.size() > 1) {
+            layer_type *c = layers.back(), *f = layers[layers.size() - 2];
+            double ratio = (double) c->vs.size() / std::max<size_t>(f->vs.size(), 1);
+            if (2 * f->vs.size() >= target_coarsest and 
+                ratio <= 0.5 * (1 + min_coarsening)) break;
+            delete f->detach_coarser();
+            layers.pop_back();
+            rejected_size = 0;
+        }
+
+        while (layers.back()->vs.size() > target_coarsest and 
+               layers.back()->vs.size() >= 2 * rejected_size) {
+            layer_type *f = layers.back(), *c = new layer_type(
+                f0, K, eps, damping, dilation);
+            c->registry = &registry;
+            f->attach_coarser(c);
+            if (c->vs.size() > min_coarsening * f->vs.size()) {
+                rejected_size = f->vs.size();
+                delete f->detach_coarser();
+                break;
+            }
+            layers.push_back(c);
+            rejected_size = 0;
+        }
+
+        depth_generation = layers_generation();
+    }
+
+    // 
+    // Background re-optimization of the hierarchy. Matching layers one edge at a
+    // time degrades the coarsening ratio and the balance of matched components as
+    // the graph is mutated over time. Every `interval` seconds a background thread
+    // takes a snapshot of the topology of the layers (under the read lock), plans a
+    // fresh coarsening of each layer from its own snapshot, and looks for the finest
+    // layer whose coarsening ratio is worse than the planned one by more than
+    // `tolerance`, or whose largest matched component has more than max_imbalance
+    // times the vertices of the largest planned one. The coarser layers of that
+    // layer are then
+    // planned again from its snapshot without holding the lock, and installed by
+    // the next call of layout(). Changes made to the graph in the meantime are
+    // kept: a planned pair of vertices is only matched if both of them still exist
+    // and share an edge, and coarse edges are built from the current edges
+    // 
+    void start_reoptimizer(double interval = 5.0, double tolerance = 0.1)
+    {
+        stop_reoptimizer();
+        reoptimizer_stop = false;
+        reoptimizer = std::thread([=]() {
+            std::unique_lock<std::mutex> l(reoptimizer_mutex);
+            while (!reoptimizer_cv.wait_for(l,
+                       std::chrono::duration<double>(interval),
+                       [this]() { return reoptimizer_stop; })) {
+                l.unlock();
+                reoptimize(tolerance);
+                l.lock();
+            }
+        });
+    }
+
+    void stop_reoptimizer(void)
+    {
+        if (!reoptimizer.joinable()) return;
+        {
+            std::lock_guard<std::mutex> l(reoptimizer_mutex);
+            reoptimizer_stop = true;
+        }
+        reoptimizer_cv.notify_all();
+        reoptimizer.join();
+    }
+
+    // 
+    // Plan the re-optimization of degraded layers, returns true if a plan is left
+    // for layout() to install. Called by the background thread, but can be called
+    // directly as well
+    // 
+    bool reoptimize(double tolerance)
+    {
+        std::unique_ptr<reoptimized_type> r(new reoptimized_type);
+        std::vector<double> ratios;
+        std::vector<size_t> max_sizes;
+        std::vector<layer_topology> ts;
+        {
+            read_lock_guard l(lock);
+            r->n_layers = layers.size();
+            for (size_t k = 0; k + 1 < layers.size(); k++) {
+                ratios.push_back((double) layers[k + 1]->vs.size() / 
+                    std::max<size_t>(layers[k]->vs.size(), 1));
+                size_t m = 0;
+                for (auto cv : layers[k + 1]->vs) m = std::max(m, cv->finer.size());
+                max_sizes.push_back(m);
+                ts.push_back(layers[k]->topology());
+            }
+        }
+
+        // the finest degraded layer, whose coarser layers are to be rebuilt. Each
+        // layer is compared with a plan of the same layer
+        size_t k = 0;
+        for (; k < ratios.size(); k++) {
+            coarsening c = plan_coarsening(ts[k], g->max_matching_rounds);
+            if (ratios[k] > (1 + tolerance) * c.ratio() or
+                max_sizes[k] > max_imbalance * c.max_size()) break;
+        }
+        ts.clear();
+        if (k == ratios.size()) return false;
+
+        layer_topology t;
+        {
+            read_lock_guard l(lock);
+            if (layers.size() != r->n_layers) return false;
+            t = layers[k]->topology();
+            for (auto v : layers[k]->vs) r->ids.push_back(v->id);
+        }
+        r->first = k;
+        for (size_t j = k; j < ratios.size(); j++) {
+            r->plan.push_back(plan_coarsening(t, g->max_matching_rounds));
+            t = r->plan.back().topology;
+        }
+
+        std::lock_guard<std::mutex> l(reoptimizer_mutex);
+        reoptimized = std::move(r);
+        return true;
+    }
+
+    // 
+    // Measure the cost of repulsion backends on this machine again, e.g. after the
+    // number of OpenMP threads was changed. The registry belongs to this graph, so
+    // other graphs may keep laying out meanwhile
+    // 
+    void calibrate_repulsion(void)
+    {
+        write_lock_guard l(lock);
+        registry.calibrate();
+    }
+
+    // 
+    // Describe the cost models of repulsion backends, and the backends chosen for
+    // components of each layer in last iteration
+    // 
+    std::string repulsion_report(void)
+    {
+        read_lock_guard l(lock);
+        std::string s = registry.report();
+        char buf[256];
+        for (size_t k = 0; k < layers.size(); k++) {
+            auto layer = layers[k];
+            snprintf(buf, sizeof(buf), "layer %lu (%lu vertices):",
+                k, layer->vs.size());
+            s += buf;
+            for (size_t b = 0; b < layer->backend_comps.size(); b++) {
+                if (layer->backend_comps[b] == 0) continue;
+                snprintf(buf, sizeof(buf), " %s (%lu components, %lu vertices)",
+                    registry.backend(b)->name(),
+                    layer->backend_comps[b], layer->backend_vertices[b]);
+                s += buf;
+            }
+            s += "\n";
+        }
+        return s;
     }
 
     virtual void render(renderer method);
@@ -99,6 +657,7 @@ public:
     virtual void randomize(void)
     {
         write_lock_guard l(lock);
+        g->generation += 1;
         for (auto v : g->vs) {
             float_type r = 5;
             v->x = vector3d_type(
@@ -109,7 +668,7 @@ public:
                 cv->x = v->x;
             }
             for (auto e : v->es) {
-                auto e_styled = dynamic_cast<edge_styled<_coord_type> *>(e);
+                auto e_styled = dynamic_cast<edge_styled<_coord_type, _dim> *>(e);
                 if (e_styled and e_styled->spline and e_styled->vspline) {
                     e_styled->vspline->x = vector3d_type(
                         rand_range(-r, r),
@@ -135,7 +694,7 @@ public:
 
         for (auto v : g->vs) {
             _coord_type x, y, z;
-            if (static_cast<vertex_styled<_coord_type> *>(v)->visible) {
+            if (static_cast<vertex_styled<_coord_type, _dim> *>(v)->visible) {
                 v->x.coord(x, y, z);
                 xmin = std::min(xmin, x);
                 xmax = std::max(xmax, x);
@@ -167,13 +726,155 @@ public:
 
 
     rw_lock lock;
+    size_t batch_vertices = 4096;   // coarse layers smaller than this are batched
     std::vector<layer_type *> layers;
     layer_type *g = nullptr;
 
+    // repulsion backends of the layers of this graph and their cost models, which
+    // are calibrated by the first layout (or by calibrate_repulsion)
+    repulsion_registry<_coord_type, _dim, _force_model> registry;
+
+private:
+    double f0, K, eps, damping, dilation;
+
+public:
+    // automatic depth, see adjust_depth()
+    bool auto_depth;
+    size_t target_coarsest = 100;   // number of vertices of the coarsest layer
+    double min_coarsening = 0.8;    // maximum ratio of vertices of a coarser layer
+    double max_imbalance = 4;       // see start_reoptimizer()
+
 private:
+    size_t depth_generation = 0;
+    size_t layers_generation(void) const {
+        size_t generation = 0;
+        for (auto layer : layers) generation += layer->generation;
+        return generation;
+    }
+
+    finest_layer<_coord_type, _dim, _force_model> *finest(void) {
+        return static_cast<finest_layer<_coord_type, _dim, _force_model> *>(g);
+    }
+    size_t rejected_size = 0;
+
+    // coarsening planned by reoptimize() for layers coarser than layer `first`,
+    // whose vertices had ids `ids` when planned
+    struct reoptimized_type {
+        size_t n_layers;
+        size_t first;
+        std::vector<int> ids;
+        std::vector<coarsening> plan;
+    };
+
+    // replace coarser layers of a degraded layer as planned by reoptimize()
+    void install_reoptimized(void)
+    {
+        std::unique_ptr<reoptimized_type> r;
+        {
+            std::lock_guard<std::mutex> l(reoptimizer_mutex);
+            r = std::move(reoptimized);
+        }
+        if (!r) return;
+
+        write_lock_guard l(lock);
+        if (r->n_layers != layers.size()) return;
+
+        // planned[i] is the index of vertex i of the layer in the plan, or -1
+        layer_type *f = layers[r->first];
+        std::unordered_map<int, long> index;
+        for (size_t i = 0; i < r->ids.size(); i++) index[r->ids[i]] = i;
+        std::vector<long> planned;
+        for (auto v : f->vs) {
+            auto p = index.find(v->id);
+            planned.push_back(p == index.end()? -1: p->second);
+        }
+
+        for (size_t k = layers.size() - 1; k > r->first; k--)
+            layers[k - 1]->detach_coarser();
+        for (size_t k = r->first; k + 1 < layers.size(); k++) {
+            f = layers[k];
+            const std::vector<long> &coarse = r->plan[k - r->first].coarse;
+            std::vector<long> coarse_of(f->vs.size()), next, member;
+            std::unordered_map<long, long> group;
+            for (size_t i = 0; i < f->vs.size(); i++) {
+                long pc = (planned[i] >= 0)? coarse[planned[i]]: -1;
+                if (pc >= 0) {
+                    auto p = group.find(pc);
+                    if (p == group.end()) {
+                        group[pc] = next.size();
+                    }
+                    else if (f->vs[i]->shared_edge(f->vs[member[p->second]])) {
+                        coarse_of[i] = p->second;
+                        continue;
+                    }
+                    else {
+                        pc = -1;
+                    }
+                }
+                coarse_of[i] = next.size();
+                next.push_back(pc);
+                member.push_back(i);
+            }
+            f->coarser = layers[k + 1];
+            f->install_coarser(
+                contract(f->topology(), std::move(coarse_of), next.size()));
+            planned = std::move(next);
+        }
+    }
+
+    std::thread reoptimizer;
+    std::mutex reoptimizer_mutex;
+    std::condition_variable reoptimizer_cv;
+    bool reoptimizer_stop = false;
+    std::unique_ptr<reoptimized_type> reoptimized;
+
+    // mutations posted by post(), applied by apply_posted()
+    mutation_queue mutations;
+
+    // apply the mutations of a batch, with the graph locked for writing
+    void replay(const batch &b)
+    {
+        for (auto &op : b.ops) {
+            switch (op.type) {
+            case batch::op_type::add_vertex: g->add_vertex(op.v); break;
+            case batch::op_type::remove_vertex: g->remove_vertex(op.v); break;
+            case batch::op_type::add_edge: g->add_edge(op.e); break;
+            case batch::op_type::remove_edge: g->remove_edge(op.e); break;
+            }
+        }
+    }
+
+    // find or create the vertices of keys, with the graph locked for writing
+    template <typename _key_type, typename _make_type>
+    size_t upsert(
+        const std::vector<_key_type> &keys, std::vector<vertex_type *> &vs,
+        _make_type &make)
+    {
+        key_index &index = finest()->keys;
+        std::vector<vertex_handle> hs(keys.size());
+        index.find(keys.data(), keys.size(), hs.data());
+        vs.resize(keys.size());
+        size_t n = 0;
+        for (size_t i = 0; i < keys.size(); i++) {
+            vs[i] = g->get(hs[i]);
+            // keys may repeat, the vertex may have been added for an earlier one
+            if (!vs[i]) vs[i] = g->get(index.find(keys[i]));
+            if (vs[i]) continue;
+            vs[i] = make(keys[i]);
+            g->add_vertex(vs[i]);
+            index.bind(keys[i], g->handle(vs[i]));
+            n += 1;
+        }
+        return n;
+    }
+
     void render_particle_edges(void);
     void render_particle_vertices(GLfloat *modelview);
     void render_particle_labels(GLfloat *modelview);
+
+    // positions and sizes of vertices gathered by render_particle_vertices
+    vector_batch<GLfloat> particle_pos;
+    std::vector<GLfloat> particle_sizes;
 };
 
 
@@ -0,0 +1,332 @@
+#ifndef _KEY_INDEX_H_
+#define _KEY_INDEX_H_
+
+
+#include "vertex_edge.hh"
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <utility>
+#include <vector>
+
+
+// 
+// Open addressing hash map from 64-bit keys to values, with linear probing and
+// backward shift deletion, so that lookups touch a few adjacent entries of one array
+// and no tombstones pile up under churn
+// 
+template <typename _value_type>
+class key_map
+{
+public:
+    typedef uint64_t key_type;
+
+    size_t size(void) const { return n; }
+    bool empty(void) const { return n == 0; }
+
+    void clear(void)
+    {
+        entries.clear();
+        n = 0;
+    }
+
+    _value_type *find(key_type k)
+    {
+        if (entries.empty()) return nullptr;
+        for (size_t i = home(k); ; i = (i + 1) & mask()) {
+            entry &e = entries[i];
+            if (!e.used) return nullptr;
+            if (e.key == k) return &e.value;
+        }
+    }
+    const _value_type *find(key_type k) const {
+        return const_cast<key_map *>(this)->find(k);
+    }
+
+    // 
+    // look up n keys at once, out[i] is the value of ks[i] or nullptr. Entries of the
+    // keys ahead are prefetched while a key is probed
+    // 
+    void find(const key_type *ks, size_t n, const _value_type **out) const
+    {
+        const size_t ahead = 8;
+        for (size_t i = 0; i < n; i++) {
+            if (i + ahead < n and !entries.empty())
+                __builtin_prefetch(&entries[home(ks[i + ahead])]);
+            out[i] = find(ks[i]);
+        }
+    }
+
+    // value of k, default constructed if k is inserted, and whether it is
+    std::pair<_value_type *, bool> insert(key_type k)
+    {
+        if ((n + 1) * 4 > entries.size() * 3) grow();
+        size_t i = home(k);
+        for (; entries[i].used; i = (i + 1) & mask()) {
+            if (entries[i].key == k) return { &entries[i].value, false };
+        }
+        entries[i].used = true;
+        entries[i].key = k;
+        entries[i].value = _value_type();
+        n += 1;
+        return { &entries[i].value, true };
+    }
+
+    bool erase(key_type k)
+    {
+        if (entries.empty()) return false;
+        size_t i = home(k);
+        for (; entries[i].key != k; i = (i + 1) & mask()) {
+            if (!entries[i].used) return false;
+        }
+        if (!entries[i].used) return false;
+        // shift back the entries of the run after i which may live at i, i.e. whose
+        // home is not within (i, j]
+        for (size_t j = (i + 1) & mask(); entries[j].used; j = (j + 1) & mask()) {
+            if (((j - home(entries[j].key)) & mask()) >= ((j - i) & mask())) {
+                entries[i] = std::move(entries[j]);
+                i = j;
+            }
+        }
+        entries[i].used = false;
+        n -= 1;
+        return true;
+    }
+
+protected:
+    struct entry {
+        key_type key = 0;
+        bool used = false;
+        _value_type value = _value_type();
+    };
+
+    static uint64_t mix(uint64_t h) {
+        h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+        return h ^ (h >> 31);
+    }
+    size_t mask(void) const { return entries.size() - 1; }
+    size_t home(key_type k) const { return mix(k) & mask(); }
+
+    void grow(void)
+    {
+        std::vector<entry> old(std::max<size_t>(entries.size() * 2, 16));
+        old.swap(entries);
+        for (auto &e : old) {
+            if (!e.used) continue;
+            size_t i = home(e.key);
+            while (entries[i].used) i = (i + 1) & mask();
+            entries[i] = std::move(e);
+        }
+    }
+
+    std::vector<entry> entries;     // size is a power of 2
+    size_t n = 0;
+};
+
+
+// 
+// Pool of interned strings, each distinct string gets a dense id until it is
+// released, and ids of released strings are reused. Ids are kept in an open
+// addressing table probed by the hash of the strings, with backward shift deletion
+// 
+class string_pool
+{
+public:
+    static const uint32_t none = UINT32_MAX;
+
+    // id of s, or none
+    uint32_t find(const std::string &s) const
+    {
+        if (table.empty()) return none;
+        size_t m = table.size() - 1;
+        for (size_t i = std::hash<std::string>()(s) & m; ; i = (i + 1) & m) {
+            if (table[i] == none or strings[table[i]] == s) return table[i];
+        }
+    }
+
+    // id of s, interning s if it is new
+    uint32_t intern(const std::string &s)
+    {
+        if ((n + 1) * 4 > table.size() * 3) grow();
+        size_t h = std::hash<std::string>()(s);
+        size_t m = table.size() - 1;
+        size_t i = h & m;
+        for (; table[i] != none; i = (i + 1) & m) {
+            if (strings[table[i]] == s) return table[i];
+        }
+        uint32_t id;
+        if (!free_ids.empty()) {
+            id = free_ids.back();
+            free_ids.pop_back();
+            strings[id] = s;
+            hashes[id] = h;
+        }
+        else {
+            id = strings.size();
+            strings.push_back(s);
+            hashes.push_back(h);
+        }
+        table[i] = id;
+        n += 1;
+        return id;
+    }
+
+    // forget the string of id, the id is given to a string interned later
+    void release(uint32_t id)
+    {
+        size_t m = table.size() - 1;
+        size_t i = hashes[id] & m;
+        while (table[i] != id) i = (i + 1) & m;
+        // shift back the ids of the run after i which may live at i
+        for (size_t j = (i + 1) & m; table[j] != none; j = (j + 1) & m) {
+            if (((j - hashes[table[j]]) & m) >= ((j - i) & m)) {
+                table[i] = table[j];
+                i = j;
+            }
+        }
+        table[i] = none;
+        std::string().swap(strings[id]);
+        free_ids.push_back(id);
+        n -= 1;
+    }
+
+    const std::string &str(uint32_t id) const { return strings[id]; }
+    size_t size(void) const { return n; }
+
+    void clear(void)
+    {
+        strings.clear();
+        hashes.clear();
+        free_ids.clear();
+        table.clear();
+        n = 0;
+    }
+
+protected:
+    void grow(void)
+    {
+        table.assign(std::max<size_t>(table.size() * 2, 16), uint32_t(none));
+        size_t m = table.size() - 1;
+        std::vector<bool> released(strings.size(), false);
+        for (auto id : free_ids) released[id] = true;
+        for (uint32_t id = 0; id < strings.size(); id++) {
+            if (released[id]) continue;
+            size_t i = hashes[id] & m;
+            while (table[i] != none) i = (i + 1) & m;
+            table[i] = id;
+        }
+    }
+
+    std::vector<std::string> strings;
+    std::vector<size_t> hashes;         // hashes of strings
+    std::vector<uint32_t> free_ids;     // ids of released strings
+    std::vector<uint32_t> table;        // ids, size is a power of 2
+    size_t n = 0;                       // number of interned strings
+};
+
+
+// 
+// Index of the vertices of a layer by external keys, 64-bit integers or strings. A
+// vertex has at most one key and a key names at most one vertex, binding a key takes
+// it (and the vertex) from previous bindings. Keys of each vertex are remembered by
+// slot, so that the layer unbinds the key of a vertex in constant time as the vertex
+// is removed. String keys are interned, a string is released as its key is unbound
+// 
+class key_index
+{
+public:
+    typedef uint64_t key_type;
+
+    vertex_handle find(key_type k) const
+    {
+        const vertex_handle *h = by_int.find(k);
+        return h? *h: vertex_handle();
+    }
+    vertex_handle find(const std::string &k) const
+    {
+        uint32_t id = strings.find(k);
+        return (id != string_pool::none)? by_string[id]: vertex_handle();
+    }
+
+    // look up n keys at once
+    void find(const key_type *ks, size_t n, vertex_handle *out) const
+    {
+        std::vector<const vertex_handle *> hs(n);
+        by_int.find(ks, n, hs.data());
+        for (size_t i = 0; i < n; i++) out[i] = hs[i]? *hs[i]: vertex_handle();
+    }
+    void find(const std::string *ks, size_t n, vertex_handle *out) const
+    {
+        for (size_t i = 0; i < n; i++) out[i] = find(ks[i]);
+    }
+
+    // bind k to the vertex of handle h, which must be in the layer
+    void bind(key_type k, vertex_handle h)
+    {
+        const key_ref &r = ref(h.slot);
+        if (r.kind == key_ref::integer and r.key == k) return;
+        unbind(h.slot);
+        vertex_handle *p = by_int.insert(k).first;
+        if (p->slot != UINT32_MAX) slot_keys[p->slot] = key_ref();
+        *p = h;
+        slot_keys[h.slot] = key_ref(k, key_ref::integer);
+    }
+    void bind(const std::string &k, vertex_handle h)
+    {
+        uint32_t id = strings.intern(k);
+        const key_ref &r = ref(h.slot);
+        if (r.kind == key_ref::string and r.key == id) return;
+        unbind(h.slot);
+        if (id >= by_string.size()) by_string.resize(id + 1);
+        vertex_handle &p = by_string[id];
+        if (p.slot != UINT32_MAX) slot_keys[p.slot] = key_ref();
+        p = h;
+        slot_keys[h.slot] = key_ref(id, key_ref::string);
+    }
+
+    // drop the key of the vertex in slot, if any
+    void unbind(uint32_t slot)
+    {
+        if (slot >= slot_keys.size()) return;
+        key_ref &r = slot_keys[slot];
+        if (r.kind == key_ref::integer) by_int.erase(r.key);
+        else if (r.kind == key_ref::string) {
+            by_string[r.key] = vertex_handle();
+            strings.release(r.key);
+        }
+        r = key_ref();
+    }
+
+    void clear(void)
+    {
+        by_int.clear();
+        by_string.clear();
+        strings.clear();
+        slot_keys.clear();
+    }
+
+protected:
+    struct key_ref {
+        enum kind_type : uint8_t { none, integer, string };
+        key_type key;           // integer key, or id of an interned string
+        kind_type kind;
+        key_ref(void) : key(0), kind(none) {}
+        key_ref(key_type key, kind_type kind) : key(key), kind(kind) {}
+    };
+
+    key_ref &ref(uint32_t slot)
+    {
+        if (slot >= slot_keys.size()) slot_keys.resize(slot + 1);
+        return slot_keys[slot];
+    }
+
+    key_map<vertex_handle> by_int;
+    string_pool strings;
+    std::vector<vertex_handle> by_string;   // by id of interned string
+    std::vector<key_ref> slot_keys;         // key of the vertex in each slot
+};
+
+
+#endif /* _KEY_INDEX_H_ */
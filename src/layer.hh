@@ -3,8 +3,15 @@
 
 
 #include "vertex_edge.hh"
-#include <queue>
-#include <set>
+#include "repulsion.hh"
+#include "numa.hh"
+#include "coarsening.hh"
+#include "key_index.hh"
+#include "pool.hh"
+#include <chrono>
+#include <cmath>
+#include <unordered_map>
+#include <unordered_set>
 
 // #define debuglog(...) {  printf(__VA_ARGS__); printf("\n");  }
 #define debuglog(...)
@@ -25,21 +32,26 @@ bool contains(const _container_ty &c, const _elem_ty &e) {
 // of coarser layer to the finer layer
 // 
 
-template <typename _coord_type>
+template <typename _coord_type, int _dim = 3,
+          typename _force_model = spring_electrical>
 class layer
 {
 public:
     typedef _coord_type float_type;
-    typedef vector3d<_coord_type> vector3d_type;
-    typedef layer<_coord_type> layer_type;
-    typedef vertex<_coord_type> vertex_type;
-    typedef edge<_coord_type> edge_type;
+    typedef _force_model force_model;
+    typedef vector3d<_coord_type, _dim> vector3d_type;
+    typedef layer<_coord_type, _dim, _force_model> layer_type;
+    typedef vertex<_coord_type, _dim> vertex_type;
+    typedef edge<_coord_type, _dim> edge_type;
+    typedef std::vector<vertex_type *, numa_allocator<vertex_type *>> vertex_array;
 
     layer(double f0, double K, double eps, double damping, double dilation)
         : f0(f0), K(K), eps(eps), damping(damping), dilation(dilation) {
     }
     layer(const layer &) = delete;
-    virtual ~layer(void) = default;
+    virtual ~layer(void) {
+        clear_focus();
+    }
 
     // 
     // add vertex v to this layer, and create corresponding coarsed version of v in
@@ -47,12 +59,16 @@ public:
     // 
     void add_vertex(vertex_type *v)
     {
-        vs.push_back(v);
+        insert_vertex(v);
+        generation += 1;
+        v->comp_parent = v;
+        v->comp_size = 1;
+        vertex_attached(v);
         if (coarser) {
-            vertex_type *cv = new vertex_type(v->x);
+            vertex_type *cv = coarser->create_vertex(v->x);
             debuglog("add_vertex: add_vertex (coarser): %d", cv->id);
             coarser->add_vertex(cv);
-            v->coarser = cv;
+            set_coarser(v, cv);
         }
     }
 
@@ -69,11 +85,23 @@ public:
         }
         assert(v->es.empty());
         if (coarser) {
+            // v must have been split off its matched component before its coarser
+            // vertex is deleted
+            if (v->coarser->finer.size() > 1) flush_splits();
+            assert(v->coarser->finer.size() == 1);
             coarser->remove_vertex(v->coarser);
-            delete v->coarser;
+            coarser->dispose_vertex(v->coarser);
         }
-        vs.erase(std::find(vs.begin(), vs.end(), v));
+        if (v->comp_parent != v or v->comp_size > 1) components_dirty = true;
+        vertex_detaching(v);
+        erase_vertex(v);
+        if (focused()) {
+            auto p = std::find(focus_vs.begin(), focus_vs.end(), v);
+            if (p != focus_vs.end()) focus_vs.erase(p);
+        }
+        generation += 1;
         v->coarser = nullptr;
+        v->finer_index = -1;
     }
 
     // 
@@ -86,9 +114,12 @@ public:
         vertex_type *a = e->a, *b = e->b;
         bool matched = a->neihash(e) and b->neihash(e);
         edge_type *ret = e->connect();
+        if (ret != e) dispose_edge(e);
+        edge_attached(ret);
+        if (!components_dirty) merge_components(a, b);
         if (coarser) {
             vertex_type *ca = a->coarser, *cb = b->coarser;
-            edge_type *e_new = new edge_type(ca, cb);
+            edge_type *e_new = coarser->create_edge(ca, cb);
             debuglog("add_edge: add_edge (coarser): %d -> %d", ca->id, cb->id);
             e_new = coarser->add_edge(e_new);
             if (matched and ca != cb) {
@@ -109,8 +140,10 @@ public:
     void remove_edge(edge_type *e)
     {
         vertex_type *a = e->a, *b = e->b;
-        e->disconnect();
+        edge_detaching(e);
+        if (e->disconnect()) dispose_edge(e);
         bool aeb_connected = (a->shared_edge(b) != nullptr);
+        if (!aeb_connected) components_dirty = true;
         if (coarser) {
             vertex_type *ca = a->coarser, *cb = b->coarser;
             debuglog("remove_edge: remove_edge (coarser): %d -> %d", ca->id, cb->id);
@@ -118,35 +151,367 @@ public:
             if (a != b and ca == cb and !aeb_connected) {
                 debuglog("removing collapsed edge (%d -> %d), might need to split", 
                     a->id, b->id);
-                split(a, b);
+                if (batching) deferred_splits.push_back({ handle(a), handle(b) });
+                else split(a, b);
+            }
+        }
+    }
+
+    // 
+    // attach layer c as the coarser layer of this layer, which must be the coarsest
+    // one, and build coarser versions of the vertices and edges of this layer in c
+    // as if they were added after c was attached
+    // 
+    void attach_coarser(layer_type *c)
+    {
+        assert(!coarser and c->vs.empty());
+        coarser = c;
+        for (auto v : vs) {
+            vertex_type *cv = c->create_vertex(v->x);
+            c->add_vertex(cv);
+            set_coarser(v, cv);
+        }
+        std::vector<edge_type *> es;
+        for (auto v : vs) {
+            for (auto e : v->es) {
+                if (e->a == v) es.push_back(e);
+            }
+        }
+        for (auto e : es) {
+            vertex_type *a = e->a, *b = e->b;
+            for (int k = 0; k < e->cnt; k++) {
+                bool matched = a->neihash(e) and b->neihash(e);
+                c->add_edge(c->create_edge(a->coarser, b->coarser));
+                if (matched and a->coarser != b->coarser) match(a, b);
+            }
+        }
+    }
+
+    // 
+    // detach the coarser layer of this layer, which must be the coarsest one, and
+    // delete its vertices and edges. The detached layer is returned empty
+    // 
+    layer_type *detach_coarser(void)
+    {
+        layer_type *c = coarser;
+        assert(c and !c->coarser);
+        for (auto v : vs) {
+            v->coarser = nullptr;
+            v->finer_index = -1;
+        }
+        coarser = nullptr;
+        auto cvs = c->vs;
+        c->clear();
+        for (auto cv : cvs) c->dispose_vertex(cv);
+        return c;
+    }
+
+    // 
+    // remove all vertices and edges from this layer and its coarser layers, in time
+    // linear in their size. Edges and coarser vertices are deleted, vertices of this
+    // layer are left to the caller, just like remove_vertex does. This must be the
+    // finest layer or the finer layers must be cleared already
+    // 
+    virtual void clear(void)
+    {
+        if (coarser) {
+            auto cvs = coarser->vs;
+            coarser->clear();
+            for (auto cv : cvs) coarser->dispose_vertex(cv);
+        }
+        clear_focus();
+        std::vector<edge_type *> es;
+        for (auto v : vs) {
+            for (auto e : v->es) {
+                if (e->a == v) es.push_back(e);
             }
         }
+        for (auto e : es) dispose_edge(e);
+        for (auto v : vs) {
+            v->es.clear();
+            v->adjacency.reset();
+            v->coarser = nullptr;
+            v->finer.clear();
+            v->finer_index = -1;
+            v->comp_parent = v;
+            v->comp_size = 1;
+            release_slot(v);
+            v->vs_index = -1;
+        }
+        vs.clear();
+        deferred_splits.clear();
+        components_dirty = true;
+        generation += 1;
+    }
+
+    // 
+    // Defer splitting matched components in this layer and the coarser layers until
+    // end_batch(). A component is checked once for all the edges removed from it in
+    // a batch, and an edge removed and added back within a batch leaves it alone
+    // instead of splitting and rematching it
+    // 
+    void begin_batch(void)
+    {
+        for (layer_type *l = this; l; l = l->coarser) l->batching = true;
+    }
+
+    void end_batch(void)
+    {
+        for (layer_type *l = this; l; l = l->coarser) {
+            l->flush_splits();
+            l->batching = false;
+        }
+    }
+
+    // handle of vertex v of this layer
+    vertex_handle handle(const vertex_type *v) const {
+        return vertex_handle(v->slot, slots[v->slot].generation);
+    }
+
+    // vertex of handle h, or nullptr if the vertex was removed from this layer
+    vertex_type *get(vertex_handle h) const {
+        if (h.slot >= slots.size() or slots[h.slot].generation != h.generation)
+            return nullptr;
+        return slots[h.slot].v;
+    }
+
+    // 
+    // add vertices and edges to this layer, which must be empty, in one pass, and
+    // build the coarser layers (which must be empty too) bottom up by matching and
+    // contracting each layer in parallel. Edges must not be refcounted, as they are
+    // connected without merging them into existing edges
+    // 
+    void add_bulk(
+        const std::vector<vertex_type *> &new_vs,
+        const std::vector<edge_type *> &new_es)
+    {
+        assert(vs.empty());
+        adopt_vertices(new_vs);
+        for (auto e : new_es) {
+            assert(!e->refcounted);
+            edge_attached(e->connect());
+        }
+        if (coarser) build_coarser();
     }
 
     // 
     // Apply numerical methods on the Lagrange Dynamics formed by the spring system
-    // defined by this graph.
+    // defined by this graph. An iteration is split into phases, so that the graph
+    // can run phases of different layers together:
+    // 
+    //  - layout_collect gathers the vertices to move into pvs, by component
+    //  - layout_move moves them with verlet integration
+    //  - layout_index builds spatial indices of components
+    //  - layout_forces computes accelerations
+    //  - layout_release releases the spatial indices
+    //  - layout_velocity updates velocities with the accelerations of coarser layer
+    // 
+    // layout_move and layout_velocity work on the integration state of the layer,
+    // and must be called by every thread of the team, each thread handles its own
+    // range of the state. The other phases run OpenMP tasks, and must be called by
+    // one thread of the team (layout() does all of that for a single layer)
     // 
-    virtual _coord_type layout(float_type dt);
-    vector3d_type repulsion_force(vertex_type *v, const std::vector<vertex_type *> &vs);
+    _coord_type layout(float_type dt);
+    void layout_collect(void);
+    void layout_move(float_type dt);
+    void layout_index(void);
+    virtual _coord_type layout_forces(float_type dt);
+    void layout_release(void);
+    void layout_velocity(float_type dt);
     vector3d_type spring_force(vertex_type *v1, vertex_type *v2, edge_type *e);
+    vector3d_type spring_force(vertex_type *v1, const spring<_coord_type, _dim> *s);
     void update_velocity(vertex_type *v, float_type dt);
     void apply_displacement(vertex_type *v, float_type dt);
 
+    // 
+    // connected components of this layer. Components are merged eagerly with a
+    // union-find structure when edges are added, removing edges or vertices only
+    // marks the components as dirty, they will be recomputed before next layout
+    // 
+    vertex_type *find_component(vertex_type *v)
+    {
+        while (v->comp_parent != v) {
+            v->comp_parent = v->comp_parent->comp_parent;
+            v = v->comp_parent;
+        }
+        return v;
+    }
+
+    void merge_components(vertex_type *a, vertex_type *b)
+    {
+        a = find_component(a);
+        b = find_component(b);
+        if (a == b) return;
+        if (a->comp_size < b->comp_size) std::swap(a, b);
+        b->comp_parent = a;
+        a->comp_size += b->comp_size;
+    }
+
+    void rebuild_components(void)
+    {
+        for (auto v : vs) {
+            v->comp_parent = v;
+            v->comp_size = 1;
+        }
+        for (auto v : vs) {
+            for (auto e : v->es) {
+                if (e->a == v) merge_components(e->a, e->b);
+            }
+        }
+        components_dirty = false;
+    }
+
+    // 
+    // derive physics flags of coarser vertices, a coarser vertex is active if any
+    // of its finer vertices is active, and pinned if all of its active finer
+    // vertices are pinned
+    // 
+    void propagate_flags(void)
+    {
+        if (!coarser) return;
+        for (auto cv : coarser->vs) {
+            cv->active = false;
+            cv->pinned = true;
+        }
+        for (auto v : vs) {
+            if (v->active) {
+                v->coarser->active = true;
+                v->coarser->pinned = v->coarser->pinned and v->pinned;
+            }
+        }
+        for (auto cv : coarser->vs) {
+            if (!cv->active) cv->pinned = false;
+        }
+    }
+
+protected:
+    // 
+    // a connected component taking part in current iteration, which occupies the
+    // range [first, last) of pvs. Repulsion forces within the component are
+    // computed by the backend selected according to its size
+    // 
+    struct component_type : public repulsion_domain<_coord_type, _dim> {
+        size_t first, last;
+        int backend;
+        bool pinned;            // containing pinned vertices, can't be moved
+    };
+
+    // collect active vertices involved in the dynamics of this layer, owners[i] is
+    // the vertex determining which component pvs[i] belongs to
+    virtual void collect_vertices(
+        vertex_array &pvs, vertex_array &owners);
+
+    // hooks for layers keeping extra state about their edges, called after e is
+    // connected and before e is disconnected
+    virtual void edge_attached(edge_type *) {}
+    virtual void edge_detaching(edge_type *) {}
+    // likewise for vertices, called after v is added and before v is removed
+    virtual void vertex_attached(vertex_type *) {}
+    virtual void vertex_detaching(vertex_type *) {}
+
+    void pack_components(std::vector<vector3d_type> &offsets);
+    vector3d_type repulsion(size_t i);
+    void build_far_field(void);
+
+    vertex_array pvs, owners, sorted;
+    std::vector<int, numa_allocator<int>> pv_comp;
+    std::vector<component_type> comps;
+    bool components_dirty = false;
+
+    // 
+    // integration state of pvs[i], kept across iterations: positions after the last
+    // move, velocities and accelerations (and scratch arrays of displacements and
+    // new accelerations for the batch kernels), one array per axis. The state is
+    // split into contiguous ranges of the workers (see numa_static_range), which
+    // first touch and then keep handling them. Velocities and accelerations are
+    // copied into the vertices after they are updated, and read back from them
+    // when pvs[i] isn't the vertex of last iteration, or when the generation of the
+    // layer changed (code changing them outside of layout has to bump the
+    // generation). Positions are always read back, anyone may change them
+    // 
+    struct state_type {
+        numa_array<vertex_type *> vs;
+        numa_array<_coord_type> x[_dim], dx[_dim], ddx[_dim];
+        numa_array<_coord_type> delta[_dim], acc[_dim];
+    } state;
+    size_t state_generation = 0;
+    bool state_stale = true;
+
+    // vertices of the region of interest. The far field is a repulsion domain of
+    // proxies of the frozen vertices outside of the region, with backends of its
+    // own for proxies. Region vertices are represented by probes (probes[i] stands
+    // for pvs[i]) when their repulsion from the far field is computed
+    typedef repulsion_proxy<_coord_type, _dim> proxy_type;
+    typedef repulsion_registry<_coord_type, _dim, proxy_model<_force_model>>
+        proxy_registry_type;
+    std::vector<vertex_type *> focus_vs;
+    std::unique_ptr<proxy_type[]> far_proxies, probes;
+    size_t n_probes = 0;
+    std::vector<vertex_type *> far_vs;
+    std::unique_ptr<proxy_registry_type> far_registry;
+    component_type far_field;
+    bool far_valid = false;
+
+public:
+    // 
+    // region of interest. While a focus is set, layout only moves the (active)
+    // vertices in the region, which repel each other as one domain whatever
+    // components they belong to. The rest of the layer is frozen and acts on the
+    // region through springs and a far field of its repulsion. The far field is a
+    // snapshot of the frozen vertices taken by the first layout after the focus is
+    // set, so that the cost of an iteration, and of mutations in between, only
+    // depends on the size of the region. Vertices removed outside of the region
+    // keep repelling it, and vertices added there don't, until the focus is set
+    // again. An empty region clears the focus
+    // 
+    void set_focus(const std::vector<vertex_type *> &region)
+    {
+        clear_focus();
+        focus_vs = region;
+    }
+
+    void clear_focus(void)
+    {
+        if (far_valid and far_field.backend >= 0)
+            far_registry->backend(far_field.backend)->release(far_field);
+        far_valid = false;
+        focus_vs.clear();
+        far_vs.clear();
+        far_proxies.reset();
+        probes.reset();
+        n_probes = 0;
+    }
+
+    bool focused(void) const { return !focus_vs.empty(); }
+
+    size_t generation = 0;
+
+
+    // repulsion backends available to this layer (the registry of its graph, or
+    // the shared one for a layer on its own), and the number of components and
+    // vertices handled by each backend in last iteration
+    repulsion_registry<_coord_type, _dim, _force_model> *registry = 
+        &repulsion_registry<_coord_type, _dim, _force_model>::instance();
+    std::vector<size_t> backend_comps;
+    std::vector<size_t> backend_vertices;
+
 protected:
 
+
     // match edge from a to b, so that a and b would be merged into the same matched
-    // component
+    // component. The coarser vertex with fewer finer vertices is merged into the
+    // other one (union by size)
     void match(vertex_type *a, vertex_type *b)
     {
         vertex_type *ca = a->coarser, *cb = b->coarser;
         assert(ca != cb);
+        if (ca->finer.size() < cb->finer.size()) std::swap(ca, cb);
         auto es = cb->es;
         for (auto e : es) {
             edge_type *e_new = 
-                (e->a == e->b)? new edge_type(ca, ca):
-                (e->a == cb)? new edge_type(ca, e->b):
-                new edge_type(e->a, ca);
+                (e->a == e->b)? coarser->create_edge(ca, ca):
+                (e->a == cb)? coarser->create_edge(ca, e->b):
+                coarser->create_edge(e->a, ca);
             int cnt = e->cnt;
             for (int k = 0; k < cnt; k++) {
                 debuglog("match: remove_edge: %d -> %d", e->a->id, e->b->id);
@@ -156,24 +521,28 @@ protected:
             }
         }
 
-        auto b_comp = matched_component(b);
-        for (auto v : b_comp) v->coarser = ca;
+        auto b_comp = cb->finer;
+        for (auto v : b_comp) set_coarser(v, ca);
         coarser->remove_vertex(cb);
-        delete cb;
+        coarser->dispose_vertex(cb);
     }
 
-    // split matched component (due to the removal of edge from a to b)
+    // split matched component (due to the removal of edge from a to b). The part
+    // of the component split off is the smaller one of a's and b's
     void split(vertex_type *a, vertex_type *b)
     {
         vertex_type *ca = a->coarser, *cb = b->coarser;
         assert(ca == cb and a != b);
-        auto split_nodes = matched_component(b);
-        if (contains(split_nodes, a)) {
+        unsigned mark;
+        auto p_split_nodes = separate(a, b, mark);
+        if (!p_split_nodes) {
             return;         // a and b are still in the same matched component, don't
                             // need to split
         }
+        auto &split_nodes = *p_split_nodes;
+        auto in_split = [mark](const vertex_type *v) { return v->mark == mark; };
         
-        vertex_type *new_cb = new vertex_type(b->x);
+        vertex_type *new_cb = coarser->create_vertex(split_nodes.front()->x);
         debuglog("split: add_vertex: %d", new_cb->id);
         coarser->add_vertex(new_cb);
 
@@ -182,12 +551,11 @@ protected:
             for (auto e : v->es) {
                 vertex_type *cv = nullptr;
                 edge_type *e_new = nullptr;
-                if (contains(split_nodes, e->a) and 
-                    contains(split_nodes, e->b)) {
+                if (in_split(e->a) and in_split(e->b)) {
                     assert(e->a->coarser == e->b->coarser);
                     if (e->a == v) {
                         cv = e->b->coarser;
-                        e_new = new edge_type(new_cb, new_cb);
+                        e_new = coarser->create_edge(new_cb, new_cb);
                     }
                     else {
                         continue; // the counter side would handle this
@@ -195,11 +563,11 @@ protected:
                 }
                 else if (e->a == v) {
                     cv = e->b->coarser;
-                    e_new = new edge_type(new_cb, cv);
+                    e_new = coarser->create_edge(new_cb, cv);
                 }
                 else {
                     cv = e->a->coarser;
-                    e_new = new edge_type(cv, new_cb);
+                    e_new = coarser->create_edge(cv, new_cb);
                 }
 
                 int cnt = e->cnt;
@@ -216,35 +584,241 @@ protected:
         }
 
         for (auto v : split_nodes) {
-            v->coarser = new_cb;
+            set_coarser(v, new_cb);
         }
     }       
 
-    // figure out all vertices in the same matched component with c 
-    std::set<vertex_type *> matched_component(vertex_type *c)
+    // take vertices whose edges are already connected as vertices of this layer
+    void adopt_vertices(const std::vector<vertex_type *> &new_vs)
     {
-        std::set<vertex_type *> matched_comp;
-        std::queue<vertex_type *> qvs;
-        qvs.push(c);
-        while (!qvs.empty()) {
-            vertex_type *v = qvs.front(); qvs.pop();
-            matched_comp.insert(v);
-            for (auto e : v->es) {
-                if (e->a != e->b and e->a->coarser == e->b->coarser) {
-                    vertex_type *vv = (v == e->b)? e->a: e->b;
-                    if (!contains(matched_comp, vv)) qvs.push(vv);
-                }
+        assert(vs.empty());
+        vs.reserve(new_vs.size());
+        for (auto v : new_vs) {
+            insert_vertex(v);
+            v->comp_parent = v;
+            v->comp_size = 1;
+            vertex_attached(v);
+        }
+        components_dirty = true;
+        generation += 1;
+    }
+
+    // 
+    // Build the coarser layers from scratch, see plan_coarsening()
+    // 
+    void build_coarser(void)
+    {
+        layer_type *l = this;
+        layer_topology t = topology();
+        while (l->coarser) {
+            coarsening c = plan_coarsening(t, max_matching_rounds);
+            l->install_coarser(c);
+            t = std::move(c.topology);
+            l = l->coarser;
+        }
+    }
+
+public:
+    // topology of this layer, indices of vertices are their positions in vs
+    layer_topology topology(void) const
+    {
+        layer_topology t;
+        t.n = vs.size();
+        std::unordered_map<const vertex_type *, long> index;
+        for (long i = 0; i < t.n; i++) index[vs[i]] = i;
+        for (long i = 0; i < t.n; i++) {
+            for (auto e : vs[i]->es) {
+                if (e->a == vs[i])
+                    t.es.push_back({ i, index[e->b], e->cnt, (float) e->strength });
+            }
+        }
+        return t;
+    }
+
+    // 
+    // create vertices and edges of the coarser layer, which must be empty, as
+    // planned by c for the topology of this layer. A coarser vertex starts at the
+    // position of its first finer vertex
+    // 
+    void install_coarser(const coarsening &c)
+    {
+        assert(coarser->vs.empty() and (long) c.coarse.size() == (long) vs.size());
+        std::vector<vertex_type *> cvs(c.topology.n, nullptr);
+        for (size_t i = 0; i < vs.size(); i++) {
+            vertex_type *&cv = cvs[c.coarse[i]];
+            if (!cv) cv = coarser->create_vertex(vs[i]->x);
+            set_coarser(vs[i], cv);
+        }
+        for (auto &r : c.topology.es) {
+            edge_type *e = coarser->create_edge(cvs[r.a], cvs[r.b]);
+            e->cnt = r.cnt;
+            e->a->attach_edge(e);
+            if (e->a != e->b) e->b->attach_edge(e);
+        }
+        coarser->adopt_vertices(cvs);
+    }
+
+protected:
+    // 
+    // Search the matched components of a and b (right after removing their edge) at
+    // the same time, always advancing the search that would have scanned fewer edges
+    // after its next vertex, until the searches meet or one of them runs out of
+    // vertices. Returns nullptr in the former case, and the vertices found by the
+    // exhausted search otherwise, which are the whole component of a or b, the one
+    // with fewer edges to be rewired.
+    // Vertices are marked with the epoch of their search instead of being put into
+    // a set
+    // 
+    std::vector<vertex_type *> *separate(vertex_type *a, vertex_type *b, unsigned &mark)
+    {
+        unsigned mark_a = ++epoch, mark_b = ++epoch;
+        search_a.assign(1, a);
+        search_b.assign(1, b);
+        a->mark = mark_a;
+        b->mark = mark_b;
+        size_t i_a = 0, i_b = 0, scanned_a = 0, scanned_b = 0;
+        while (true) {
+            if (i_a == search_a.size()) {
+                mark = mark_a;
+                return &search_a;
+            }
+            if (i_b == search_b.size()) {
+                mark = mark_b;
+                return &search_b;
             }
+            bool met = (scanned_a + search_a[i_a]->es.size() <= 
+                        scanned_b + search_b[i_b]->es.size())?
+                expand(search_a[i_a++], mark_a, mark_b, search_a, scanned_a):
+                expand(search_b[i_b++], mark_b, mark_a, search_b, scanned_b);
+            if (met) return nullptr;
+        }
+    }
+
+    // visit matched neighbours of v, returns true if the other search was reached
+    bool expand(vertex_type *v, unsigned mine, unsigned other,
+        std::vector<vertex_type *> &found, size_t &scanned)
+    {
+        scanned += v->es.size();
+        for (auto e : v->es) {
+            if (e->a == e->b or e->a->coarser != e->b->coarser) continue;
+            vertex_type *u = (e->a == v)? e->b: e->a;
+            if (u->mark == other) return true;
+            if (u->mark != mine) {
+                u->mark = mine;
+                found.push_back(u);
+            }
+        }
+        return false;
+    }
+
+    // make cv the coarser vertex of v, keeping the lists of finer vertices
+    void set_coarser(vertex_type *v, vertex_type *cv)
+    {
+        if (v->coarser) {
+            auto &finer = v->coarser->finer;
+            finer[v->finer_index] = finer.back();
+            finer[v->finer_index]->finer_index = v->finer_index;
+            finer.pop_back();
+        }
+        v->coarser = cv;
+        v->finer_index = cv->finer.size();
+        cv->finer.push_back(v);
+    }
+
+    unsigned epoch = 0;
+    std::vector<vertex_type *> search_a, search_b;
+
+    // split the matched components of the collapsed edges removed in a batch so far,
+    // which might split components of the coarser layer in turn
+    void flush_splits(void)
+    {
+        auto pairs = std::move(deferred_splits);
+        deferred_splits.clear();
+        for (auto &p : pairs) {
+            vertex_type *a = get(p.first), *b = get(p.second);
+            if (a and b and a->coarser == b->coarser) split(a, b);
+        }
+    }
+
+    bool batching = false;
+    std::vector<std::pair<vertex_handle, vertex_handle>> deferred_splits;
+
+    // 
+    // slot map of the vertices. vs is kept dense by moving the last vertex into the
+    // place of a removed one, and slots[v->slot] points to v as long as v is in this
+    // layer. Removing v bumps the generation of its slot before the slot is reused,
+    // which invalidates the handles of v
+    // 
+    struct slot_type {
+        vertex_type *v;
+        uint32_t generation;
+    };
+    std::vector<slot_type> slots;
+    std::vector<uint32_t> free_slots;
+
+    void insert_vertex(vertex_type *v)
+    {
+        v->vs_index = vs.size();
+        vs.push_back(v);
+        if (free_slots.empty()) {
+            v->slot = slots.size();
+            slots.push_back(slot_type { v, 0 });
         }
-        return matched_comp;
+        else {
+            v->slot = free_slots.back();
+            free_slots.pop_back();
+            slots[v->slot].v = v;
+        }
+    }
+
+    void erase_vertex(vertex_type *v)
+    {
+        assert(v->vs_index >= 0 and vs[v->vs_index] == v);
+        vs[v->vs_index] = vs.back();
+        vs[v->vs_index]->vs_index = v->vs_index;
+        vs.pop_back();
+        v->vs_index = -1;
+        release_slot(v);
+    }
+
+    void release_slot(vertex_type *v)
+    {
+        slots[v->slot].v = nullptr;
+        slots[v->slot].generation += 1;
+        free_slots.push_back(v->slot);
+        v->slot = UINT32_MAX;
+    }
+
+    // 
+    // coarser vertices and edges living in this layer are allocated from its pools
+    // by the finer layer, and returned to them when they are removed (or merged
+    // into an existing edge). Vertices and edges of the finest layer belong to the
+    // caller, which allocates them with new
+    // 
+    vertex_type *create_vertex(const vector3d_type &x) {
+        return vertex_pool.create(x);
+    }
+    void dispose_vertex(vertex_type *v) {
+        vertex_pool.destroy(v);
+    }
+    edge_type *create_edge(vertex_type *a, vertex_type *b) {
+        return edge_pool.create(a, b);
+    }
+    virtual void dispose_edge(edge_type *e) {
+        edge_pool.destroy(e);
     }
 
+    object_pool<vertex_type> vertex_pool;
+    object_pool<edge_type> edge_pool;
 
 public:
     std::vector<vertex_type *> vs;
     layer_type *coarser = nullptr;
+    int max_matching_rounds = 8;    // rounds of matching in build_coarser()
 
 protected:
+    template <typename, int, typename> friend class distributed_layout;
+
     float_type f0;              // repulsion factor
     float_type K;               // spring factor
     float_type eps;             // small constant to get rid of division singularity
@@ -258,21 +832,192 @@ protected:
 // Finest layer of the graph, which contains only styled vertices. We applies special
 // treatments for spline edges by layouting their centroid vertices in this layer
 // 
-template <typename _coord_type>
-class finest_layer : public layer<_coord_type>
+template <typename _coord_type, int _dim = 3,
+          typename _force_model = spring_electrical>
+class finest_layer : public layer<_coord_type, _dim, _force_model>
 {
 public:
     typedef _coord_type float_type;
-    typedef vector3d<_coord_type> vector3d_type;
-    typedef layer<_coord_type> layer_type;
-    typedef vertex<_coord_type> vertex_type;
-    typedef edge<_coord_type> edge_type;
+    typedef vector3d<_coord_type, _dim> vector3d_type;
+    typedef layer<_coord_type, _dim, _force_model> layer_type;
+    typedef vertex<_coord_type, _dim> vertex_type;
+    typedef edge<_coord_type, _dim> edge_type;
+    typedef spring<_coord_type, _dim> spring_type;
+    typedef typename layer_type::vertex_array vertex_array;
 
     finest_layer(double f0, double K, double eps, double damping, double dilation)
-        : layer<_coord_type>(f0, K, eps, damping, dilation) {
+        : layer_type(f0, K, eps, damping, dilation),
+          epoch(std::chrono::steady_clock::now()) {
+    }
+
+    virtual _coord_type layout_forces(float_type dt);
+
+    virtual void clear(void)
+    {
+        for (auto v : this->vs) {
+            auto v_styled = static_cast<vertex_styled<_coord_type, _dim> *>(v);
+            v_styled->springs.clear();
+            v_styled->expiry.unlink();
+        }
+        springs.clear();
+        centroids.clear();
+        keys.clear();
+        layer_type::clear();
+    }
+
+    // 
+    // Collect vertices and edges whose time to live has run out by now into
+    // expired_vs and expired_es. Expiry is kept by timer wheels, so the cost only
+    // depends on the number of expired elements and the time elapsed, not on the
+    // number of elements with a time to live
+    // 
+    void collect_expired(
+        std::vector<vertex_type *> &expired_vs, std::vector<edge_type *> &expired_es)
+    {
+        uint64_t t = clock_tick();
+        edge_expiry.advance(t, expired_es);
+        vertex_expiry.advance(t, expired_vs);
+    }
+
+    // whether collect_expired() may find anything, only reads the timer wheels
+    bool expiry_pending(void) const
+    {
+        uint64_t t = clock_tick();
+        return (t > edge_expiry.tick() and !edge_expiry.empty()) or
+            (t > vertex_expiry.tick() and !vertex_expiry.empty());
+    }
+
+    // current tick of the expiry clock
+    uint64_t clock_tick(void) const
+    {
+        std::chrono::duration<double> d = std::chrono::steady_clock::now() - epoch;
+        return (uint64_t) (d.count() / expiry_resolution);
+    }
+
+    // change the strength of an edge in the layer, and of its aggregated spring
+    void set_strength(edge_type *e, _coord_type strength)
+    {
+        auto e_styled = static_cast<edge_styled<_coord_type, _dim> *>(e);
+        e->strength = strength;
+        if (!e_styled->in_spring) return;
+        springs[spring_key(e->a, e->b)].strength +=
+            strength - e_styled->spring_strength;
+        e_styled->spring_strength = strength;
+    }
+
+    // 
+    // lightweight mode for centroids of spline edges. Centroids are left out of
+    // the global repulsion, they only feel the ends of their edges and at most
+    // spline_neighbours other centroids around each end, and are only moved every
+    // spline_interval iterations
+    // 
+    bool spline_light = false;
+    int spline_interval = 1;
+    int spline_neighbours = 8;
+
+    // seconds per tick of the expiry clock, times to live are rounded up to ticks.
+    // Must be set before elements with a time to live are added
+    double expiry_resolution = 0.01;
+
+    // external keys of vertices, a key is dropped as its vertex is removed
+    key_index keys;
+
+protected:
+    virtual void collect_vertices(
+        vertex_array &pvs, vertex_array &owners);
+    vector3d_type centroid_force(vertex_type *c);
+
+    std::vector<vertex_type *> centroids;
+    size_t n_iterations = 0;
+
+    // 
+    // parallel edges are collapsed into one spring per unordered pair of vertices,
+    // each styled edge is still rendered on its own
+    // 
+    virtual void edge_attached(edge_type *e)
+    {
+        auto e_styled = static_cast<edge_styled<_coord_type, _dim> *>(e);
+        if (e_styled->ttl > 0) {
+            e_styled->expiry.owner = e;
+            schedule_expiry(edge_expiry, &e_styled->expiry, e_styled->ttl);
+        }
+        if (e->a == e->b or e_styled->spline) return;
+        spring_type &s = springs[spring_key(e->a, e->b)];
+        if (s.cnt == 0) {
+            s.a = e->a;
+            s.b = e->b;
+            static_cast<vertex_styled<_coord_type, _dim> *>(e->a)->springs.push_back(&s);
+            static_cast<vertex_styled<_coord_type, _dim> *>(e->b)->springs.push_back(&s);
+        }
+        s.cnt += 1;
+        s.strength += e->strength;
+        if (e->oriented) s.oriented += (e->a == s.a)? 1: -1;
+        e_styled->spring_strength = e->strength;
+        e_styled->in_spring = true;
+    }
+
+    virtual void edge_detaching(edge_type *e)
+    {
+        auto e_styled = static_cast<edge_styled<_coord_type, _dim> *>(e);
+        e_styled->expiry.unlink();
+        if (!e_styled->in_spring) return;
+        auto p = springs.find(spring_key(e->a, e->b));
+        assert(p != springs.end());
+        spring_type &s = p->second;
+        s.cnt -= 1;
+        s.strength -= e_styled->spring_strength;
+        if (e->oriented) s.oriented -= (e->a == s.a)? 1: -1;
+        e_styled->in_spring = false;
+        if (s.cnt == 0) {
+            for (auto v : { s.a, s.b }) {
+                auto &ss = static_cast<vertex_styled<_coord_type, _dim> *>(v)->springs;
+                ss.erase(std::find(ss.begin(), ss.end(), &s));
+            }
+            springs.erase(p);
+        }
     }
 
-    virtual _coord_type layout(float_type dt);
+    virtual void vertex_attached(vertex_type *v)
+    {
+        auto v_styled = static_cast<vertex_styled<_coord_type, _dim> *>(v);
+        if (v_styled->ttl <= 0) return;
+        v_styled->expiry.owner = v;
+        schedule_expiry(vertex_expiry, &v_styled->expiry, v_styled->ttl);
+    }
+
+    virtual void vertex_detaching(vertex_type *v)
+    {
+        static_cast<vertex_styled<_coord_type, _dim> *>(v)->expiry.unlink();
+        keys.unbind(v->slot);
+    }
+
+    virtual void dispose_edge(edge_type *e) {
+        delete e;
+    }
+
+    template <typename _owner_type>
+    void schedule_expiry(timer_wheel<_owner_type> &wheel,
+        timer_link<_owner_type> *link, double ttl)
+    {
+        uint64_t t = clock_tick();
+        wheel.schedule(link, t + (uint64_t) std::ceil(ttl / expiry_resolution), t);
+    }
+
+    std::chrono::steady_clock::time_point epoch;
+    timer_wheel<vertex_type> vertex_expiry;
+    timer_wheel<edge_type> edge_expiry;
+
+    typedef std::pair<vertex_type *, vertex_type *> spring_key_type;
+    static spring_key_type spring_key(vertex_type *a, vertex_type *b) {
+        return (a < b)? spring_key_type(a, b): spring_key_type(b, a);
+    }
+    struct spring_key_hash {
+        size_t operator()(const spring_key_type &k) const {
+            std::hash<vertex_type *> h;
+            return h(k.first) * 31 + h(k.second);
+        }
+    };
+    std::unordered_map<spring_key_type, spring_type, spring_key_hash> springs;
 };
 
 
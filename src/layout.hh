@@ -3,30 +3,26 @@
 
 
 #include "layer.hh"
-#include "spatial_octree.hh"
-
-
-// #define REPULSION_BRUTE_FORCE
-#define REPULSION_OCTREE_THRESHOLD 2000
 
 
 // 
-// Figure out the size of the bounding box stretched by specified vertices
+// Figure out the size of the bounding box stretched by vertices in [begin, end)
 // 
-template <typename _coord_type>
+template <typename _coord_type, int _dim>
 inline void bounding_box(
-    const std::vector<vertex<_coord_type> *> &vs,
+    vertex<_coord_type, _dim> * const *begin,
+    vertex<_coord_type, _dim> * const *end,
     _coord_type &x_min, _coord_type &x_max,
     _coord_type &y_min, _coord_type &y_max,
     _coord_type &z_min, _coord_type &z_max)
 {
-    _coord_type xmin = -10, xmax = 10;
-    _coord_type ymin = -10, ymax = 10;
-    _coord_type zmin = -10, zmax = 10;
+    _coord_type xmin, xmax, ymin, ymax, zmin, zmax;
+    (*begin)->x.coord(xmin, ymin, zmin);
+    xmax = xmin; ymax = ymin; zmax = zmin;
 
-    for (auto v : vs) {
+    for (auto p = begin; p != end; ++p) {
         _coord_type x, y, z;
-        v->x.coord(x, y, z);
+        (*p)->x.coord(x, y, z);
         xmin = std::min(xmin, x);
         xmax = std::max(xmax, x);
         ymin = std::min(ymin, y);
@@ -35,9 +31,9 @@ inline void bounding_box(
         zmax = std::max(zmax, z);
     }
 
-    x_min = xmin - 10; x_max = xmax + 10;
-    y_min = ymin - 10; y_max = ymax + 10;
-    z_min = zmin - 10; z_max = zmax + 10;
+    x_min = xmin; x_max = xmax;
+    y_min = ymin; y_max = ymax;
+    z_min = zmin; z_max = zmax;
 }
 
 
@@ -46,63 +42,65 @@ inline void bounding_box(
 // defined by this graph.
 // 
 
-template <typename _coord_type>
-vector3d<_coord_type> layer<_coord_type>::repulsion_force(
-    vertex_type *v,
-    const std::vector<vertex_type *> &vs)
-{
-    vector3d_type F_r = vector3d_type::zero;
-    _coord_type reps = 2 / sqrt(eps);
-    for (auto v2 : vs) {
-        if (v != v2) {
-            auto dx = v->x - v2->x;
-            auto rdd = dx.rmod();
-            auto denom = rdd;
-            auto fac = f0 * (denom * denom * denom);
-            if (rdd > reps) {
-                fac = 1;
-                dx = vector3d_type(
-                    rand_range(-reps, reps),
-                    rand_range(-reps, reps),
-                    rand_range(-reps, reps));
-            }
-            F_r += fac * dx;
-        }
-    }
-    return F_r;
-}
-
-
-template <typename _coord_type>
-vector3d<_coord_type> layer<_coord_type>::spring_force(
+template <typename _coord_type, int _dim, typename _force_model>
+vector3d<_coord_type, _dim> layer<_coord_type, _dim, _force_model>::spring_force(
     vertex_type *v1, vertex_type *v2,
     edge_type *e)
 {
     vector3d_type F_p = vector3d_type::zero;
     auto dx = v1->x - v2->x;
-    F_p -= K * dx * e->strength;
+    F_p -= _force_model::attraction(K, e->strength, dx) * dx;
     if (e->oriented) {
+        _coord_type bias = _force_model::oriented_bias;
         F_p += ((e->b == v1)? 
-            vector3d_type(0, -0.4, 0):
-            vector3d_type(0,  0.4, 0));
+            vector3d_type(0, -bias, 0):
+            vector3d_type(0,  bias, 0));
     }
     return F_p;
 }
 
 
-template <typename _coord_type>
-void layer<_coord_type>::update_velocity(vertex_type *v, float_type dt)
+// spring force on v1 exerted by an aggregated spring of parallel edges
+template <typename _coord_type, int _dim, typename _force_model>
+vector3d<_coord_type, _dim> layer<_coord_type, _dim, _force_model>::spring_force(
+    vertex_type *v1, const spring<_coord_type, _dim> *s)
 {
-    if (v->coarser) v->ddx_ += dilation * v->coarser->ddx;
+    vertex_type *v2 = (s->a == v1)? s->b: s->a;
+    auto dx = v1->x - v2->x;
+    vector3d_type F_p = vector3d_type::zero;
+    F_p -= _force_model::attraction(K, s->strength, dx) * dx;
+    if (s->oriented) {
+        _coord_type bias = _force_model::oriented_bias * 
+            ((s->a == v1)? s->oriented: -s->oriented);
+        F_p += vector3d_type(0, bias, 0);
+    }
+    return F_p;
+}
+
+
+template <typename _coord_type, int _dim, typename _force_model>
+void layer<_coord_type, _dim, _force_model>::update_velocity(
+    vertex_type *v, float_type dt)
+{
+    if (v->pinned) {
+        v->dx = v->ddx = vector3d_type::zero;
+        return;
+    }
+    if (v->coarser and !focused()) v->ddx_ += dilation * v->coarser->ddx;
     v->dx += float_type(0.5) * (v->ddx + v->ddx_) * dt;
     v->dx *= damping;
     v->ddx = v->ddx_;
 }
 
 
-template <typename _coord_type>
-void layer<_coord_type>::apply_displacement(vertex_type *v, float_type dt)
+template <typename _coord_type, int _dim, typename _force_model>
+void layer<_coord_type, _dim, _force_model>::apply_displacement(
+    vertex_type *v, float_type dt)
 {    
+    if (v->pinned) {
+        v->delta = vector3d_type::zero;
+        return;
+    }
     v->delta = v->dx * dt + (float_type(0.5) * dt*dt) * v->ddx;
     v->delta.bound(3);
     v->x += v->delta;
@@ -110,49 +108,424 @@ void layer<_coord_type>::apply_displacement(vertex_type *v, float_type dt)
 
 
 
-template <typename _coord_type>
-_coord_type layer<_coord_type>::layout(float_type dt)
+// 
+// Place bounding boxes of components side by side on shelves in the xy-plane, so
+// that disconnected components don't need to repel each other. Larger components
+// are placed first, and the whole packing is centered around the origin. Components
+// containing pinned vertices stay where they are, the others are packed to the
+// right of them
+// 
+template <typename _coord_type, int _dim, typename _force_model>
+void layer<_coord_type, _dim, _force_model>::pack_components(
+    std::vector<vector3d_type> &offsets)
 {
-    _coord_type max_ddx = 0;
-    size_t n_vs = vs.size();
+    const _coord_type gap = 10;
+    size_t n_comps = comps.size();
+    std::vector<size_t> order;
+    _coord_type area = 0;
+    bool anchored = false;
+    _coord_type anchor_x = 0, anchor_y = 0;
+    for (size_t c = 0; c < n_comps; c++) {
+        if (comps[c].pinned) {
+            anchor_x = anchored? std::max(anchor_x, comps[c].x_max): comps[c].x_max;
+            anchor_y = anchored? std::min(anchor_y, comps[c].y_min): comps[c].y_min;
+            anchored = true;
+            continue;
+        }
+        order.push_back(c);
+        area += (comps[c].x_max - comps[c].x_min + gap) * 
+            (comps[c].y_max - comps[c].y_min + gap);
+    }
+    std::stable_sort(order.begin(), order.end(), [this](size_t c0, size_t c1) {
+            return comps[c0].last - comps[c0].first > 
+                comps[c1].last - comps[c1].first;
+        });
+
+    _coord_type row_width = sqrt(area);
+    _coord_type x = 0, y = 0, row_height = 0, width = 0;
+    offsets.assign(n_comps, vector3d_type::zero);
+    for (auto c : order) {
+        const component_type &comp = comps[c];
+        _coord_type w = comp.x_max - comp.x_min + gap;
+        _coord_type h = comp.y_max - comp.y_min + gap;
+        if (x > 0 and x + w > row_width) {
+            x = 0;
+            y += row_height;
+            row_height = 0;
+        }
+        offsets[c] = vector3d_type(
+            x - comp.x_min, y - comp.y_min, 
+            _coord_type(-0.5) * (comp.z_min + comp.z_max));
+        x += w;
+        row_height = std::max(row_height, h);
+        width = std::max(width, x);
+    }
 
-    // move vertices with verlet integration on this layer
-    // for (auto v : vs) apply_displacement(v, dt);
-#pragma omp parallel for
-    for (size_t i = 0; i < n_vs; i++) {
-        apply_displacement(vs[i], dt);
+    vector3d_type center = anchored?
+        vector3d_type(anchor_x + gap, anchor_y, 0):
+        vector3d_type(
+            _coord_type(-0.5) * width, _coord_type(-0.5) * (y + row_height), 0);
+    for (auto c : order) offsets[c] += center;
+}
+
+
+template <typename _coord_type, int _dim, typename _force_model>
+void layer<_coord_type, _dim, _force_model>::collect_vertices(
+    vertex_array &pvs, vertex_array &owners)
+{
+    pvs.clear();
+    for (auto v : focused()? focus_vs: vs) {
+        if (v->active) pvs.push_back(v);
     }
+    owners = pvs;
+}
 
-#ifndef REPULSION_BRUTE_FORCE
-    // construct spatial octree
-    _coord_type x_min, x_max, y_min, y_max, z_min, z_max;
-    bounding_box(vs, x_min, x_max, y_min, y_max, z_min, z_max);    
-    spatial_octree<_coord_type> *t = spatial_octree<_coord_type>::alloc(
-        nullptr, 
-        x_min, x_max, 
-        y_min, y_max, 
-        z_min, z_max);
-    for (auto v : vs) t->insert(v);
-#endif
 
-    // calculate force/acceleration with Lagrange Dynamics
-#pragma omp parallel for
+// 
+// Summarize repulsion of active vertices outside of the region of interest. These
+// vertices don't move while the focus is set, so their proxies are taken once, and
+// don't refer to the vertices, which may be removed later on
+// 
+template <typename _coord_type, int _dim, typename _force_model>
+void layer<_coord_type, _dim, _force_model>::build_far_field(void)
+{
+    std::unordered_set<vertex_type *> region(focus_vs.begin(), focus_vs.end());
+    size_t n = 0;
+    for (auto v : vs) n += (v->active and !contains(region, v));
+    far_proxies.reset(new proxy_type[n]);
+    far_vs.clear();
+    for (auto v : vs) {
+        if (v->active and !contains(region, v)) {
+            v->delta = vector3d_type::zero;
+            proxy_type &p = far_proxies[far_vs.size()];
+            p.x = v->x;
+            p.m = _force_model::mass(v);
+            far_vs.push_back(&p);
+        }
+    }
+
+    if (!far_registry) far_registry.reset(new proxy_registry_type);
+    far_registry->copy_coefficients(*registry);
+    far_field.begin = far_vs.data();
+    far_field.end = far_vs.data() + far_vs.size();
+    far_field.f0 = f0;
+    far_field.eps = eps;
+    far_field.state = nullptr;
+    far_field.backend = -1;
+    if (!far_vs.empty()) {
+        bounding_box(far_field.begin, far_field.end,
+            far_field.x_min, far_field.x_max,
+            far_field.y_min, far_field.y_max,
+            far_field.z_min, far_field.z_max);
+        far_field.backend = far_registry->select(far_vs.size());
+        far_registry->backend(far_field.backend)->build(far_field);
+    }
+    far_valid = true;
+}
+
+
+// 
+// Prepare for an iteration: group vertices by connected component, so that each
+// component is a range of pvs. The vertices in the region of interest form one
+// domain, so components are left alone while the focus is set
+// 
+template <typename _coord_type, int _dim, typename _force_model>
+void layer<_coord_type, _dim, _force_model>::layout_collect(void)
+{
+    collect_vertices(pvs, owners);
+    size_t n_vs = pvs.size();
+    comps.clear();
+    if (focused()) {
+        if (n_vs) {
+            comps.push_back(component_type());
+            comps[0].first = 0;
+            comps[0].last = n_vs;
+        }
+        pv_comp.assign(n_vs, 0);
+        if (n_vs > n_probes) {
+            probes.reset(new proxy_type[n_vs]);
+            n_probes = n_vs;
+        }
+    }
+    else {
+        if (components_dirty) rebuild_components();
+        for (auto &o : owners) o = find_component(o);
+        for (auto o : owners) o->comp_index = -1;
+
+        // counting sort vertices by their components
+        std::vector<size_t> counts;
+        for (auto o : owners) {
+            if (o->comp_index < 0) {
+                o->comp_index = (int) comps.size();
+                comps.push_back(component_type());
+                counts.push_back(0);
+            }
+            counts[o->comp_index] += 1;
+        }
+        for (size_t c = 0, offset = 0; c < comps.size(); c++) {
+            comps[c].first = comps[c].last = offset;
+            offset += counts[c];
+        }
+        sorted.resize(n_vs);
+        pv_comp.resize(n_vs);
+        for (size_t i = 0; i < n_vs; i++) {
+            int c = owners[i]->comp_index;
+            pv_comp[comps[c].last] = c;
+            sorted[comps[c].last++] = pvs[i];
+        }
+        pvs.swap(sorted);
+    }
+    for (auto &comp : comps) {
+        comp.begin = pvs.data() + comp.first;
+        comp.end = pvs.data() + comp.last;
+        comp.f0 = f0;
+        comp.eps = eps;
+        comp.state = nullptr;
+    }
+
+    // storage of the state is kept as long as it is large enough, a new one is
+    // filled from the vertices by the workers owning its ranges
+    bool grown = state.vs.resize(n_vs);
+    for (int k = 0; k < _dim; k++) {
+        grown |= state.x[k].resize(n_vs);
+        grown |= state.dx[k].resize(n_vs);
+        grown |= state.ddx[k].resize(n_vs);
+        state.delta[k].resize(n_vs);
+        state.acc[k].resize(n_vs);
+    }
+    state_stale = grown or state_generation != generation;
+    state_generation = generation;
+}
+
+
+// 
+// move vertices of the range of the calling thread with verlet integration: the
+// state is brought up to date with the vertices, moved by the batch kernels, and
+// the new positions are copied back into the vertices
+// 
+template <typename _coord_type, int _dim, typename _force_model>
+void layer<_coord_type, _dim, _force_model>::layout_move(float_type dt)
+{
+    size_t first, last;
+    numa_static_range(pvs.size(), first, last);
+    for (size_t i = first; i < last; i++) {
+        vertex_type *v = pvs[i];
+        _coord_type x[3], dx[3], ddx[3];
+        if (state_stale or state.vs[i] != v) {
+            state.vs[i] = v;
+            v->dx.coord(dx[0], dx[1], dx[2]);
+            v->ddx.coord(ddx[0], ddx[1], ddx[2]);
+            for (int k = 0; k < _dim; k++) {
+                state.dx[k][i] = dx[k];
+                state.ddx[k][i] = ddx[k];
+            }
+        }
+        if (v->pinned) {
+            for (int k = 0; k < _dim; k++) state.dx[k][i] = state.ddx[k][i] = 0;
+        }
+        v->x.coord(x[0], x[1], x[2]);
+        for (int k = 0; k < _dim; k++) state.x[k][i] = x[k];
+    }
+
+    if (last > first) {
+        for (int k = 0; k < _dim; k++) {
+            batch_bounded_add(
+                state.x[k].data() + first, state.delta[k].data() + first,
+                state.dx[k].data() + first, state.ddx[k].data() + first,
+                dt, float_type(0.5) * dt*dt, _coord_type(3), last - first);
+        }
+    }
+
+    for (size_t i = first; i < last; i++) {
+        vertex_type *v = pvs[i];
+        _coord_type x[3] = { 0, 0, 0 }, delta[3] = { 0, 0, 0 };
+        for (int k = 0; k < _dim; k++) {
+            x[k] = state.x[k][i];
+            delta[k] = state.delta[k][i];
+        }
+        v->delta = vector3d_type(delta[0], delta[1], delta[2]);
+        v->x = vector3d_type(x[0], x[1], x[2]);
+    }
+}
+
+
+// 
+// Pack components and prepare the repulsion backend of each component, after the
+// vertices are moved
+// 
+template <typename _coord_type, int _dim, typename _force_model>
+void layer<_coord_type, _dim, _force_model>::layout_index(void)
+{
+    size_t n_vs = pvs.size(), n_comps = comps.size();
+#pragma omp taskloop grainsize(1)
+    for (size_t c = 0; c < n_comps; c++) {
+        component_type &comp = comps[c];
+        _coord_type lo[3] = { 0, 0, 0 }, hi[3] = { 0, 0, 0 };
+        for (int k = 0; k < _dim; k++) {
+            batch_bounds(state.x[k].data() + comp.first, comp.last - comp.first,
+                lo[k], hi[k]);
+        }
+        comp.x_min = lo[0]; comp.x_max = hi[0];
+        comp.y_min = lo[1]; comp.y_max = hi[1];
+        comp.z_min = lo[2]; comp.z_max = hi[2];
+        comp.pinned = std::any_of(comp.begin, comp.end, 
+            [](const vertex_type *v) { return v->pinned; });
+    }
+
+    // components are laid out independently, and then packed together. Parts of
+    // components in the region of interest must stay where they are
+    if (n_comps > 1 and !focused()) {
+        std::vector<vector3d_type> offsets;
+        pack_components(offsets);
+#pragma omp taskloop grainsize(1024)
+        for (size_t i = 0; i < n_vs; i++) {
+            pvs[i]->x += offsets[pv_comp[i]];
+        }
+        for (size_t c = 0; c < n_comps; c++) {
+            _coord_type ox, oy, oz;
+            offsets[c].coord(ox, oy, oz);
+            comps[c].x_min += ox; comps[c].x_max += ox;
+            comps[c].y_min += oy; comps[c].y_max += oy;
+            comps[c].z_min += oz; comps[c].z_max += oz;
+        }
+    }
+
+    // select repulsion backend for each component, and construct spatial indices
+    registry->ensure_calibrated();
+    backend_comps.assign(registry->size(), 0);
+    backend_vertices.assign(registry->size(), 0);
+    for (auto &comp : comps) {
+        comp.backend = registry->select(comp.last - comp.first);
+        backend_comps[comp.backend] += 1;
+        backend_vertices[comp.backend] += comp.last - comp.first;
+    }
+#pragma omp taskloop grainsize(1)
+    for (size_t c = 0; c < n_comps; c++) {
+        registry->backend(comps[c].backend)->build(comps[c]);
+    }
+
+    if (focused() and !far_valid) build_far_field();
+}
+
+
+// repulsion force on pvs[i], exerted by vertices in the same component, and by the
+// frozen vertices outside of the region of interest
+template <typename _coord_type, int _dim, typename _force_model>
+vector3d<_coord_type, _dim> layer<_coord_type, _dim, _force_model>::repulsion(size_t i)
+{
+    const component_type &comp = comps[pv_comp[i]];
+    vector3d_type F_r = registry->backend(comp.backend)->force(comp, pvs[i]);
+    if (focused() and far_field.backend >= 0) {
+        proxy_type &probe = probes[i];
+        probe.x = pvs[i]->x;
+        probe.m = _force_model::mass(pvs[i]);
+        F_r += far_registry->backend(far_field.backend)->force(far_field, &probe);
+    }
+    return F_r;
+}
+
+
+template <typename _coord_type, int _dim, typename _force_model>
+void layer<_coord_type, _dim, _force_model>::layout_release(void)
+{
+    size_t n_comps = comps.size();
+#pragma omp taskloop grainsize(1)
+    for (size_t c = 0; c < n_comps; c++) {
+        registry->backend(comps[c].backend)->release(comps[c]);
+    }
+}
+
+
+// 
+// update velocities of the range of the calling thread: accelerations of the
+// vertices (and their coarser vertices) are gathered into the state, integrated by
+// the batch kernel, and copied back into the vertices
+// 
+template <typename _coord_type, int _dim, typename _force_model>
+void layer<_coord_type, _dim, _force_model>::layout_velocity(float_type dt)
+{
+    size_t first, last;
+    numa_static_range(pvs.size(), first, last);
+    for (size_t i = first; i < last; i++) {
+        vertex_type *v = pvs[i];
+        vector3d_type a = vector3d_type::zero;
+        if (!v->pinned) {
+            a = v->ddx_;
+            if (v->coarser and !focused()) a += dilation * v->coarser->ddx;
+        }
+        _coord_type acc[3];
+        a.coord(acc[0], acc[1], acc[2]);
+        for (int k = 0; k < _dim; k++) state.acc[k][i] = acc[k];
+    }
+
+    if (last > first) {
+        for (int k = 0; k < _dim; k++) {
+            batch_verlet(
+                state.dx[k].data() + first, state.ddx[k].data() + first,
+                state.acc[k].data() + first, float_type(0.5) * dt, damping,
+                last - first);
+        }
+    }
+
+    for (size_t i = first; i < last; i++) {
+        vertex_type *v = pvs[i];
+        if (v->pinned) {
+            for (int k = 0; k < _dim; k++) state.dx[k][i] = 0;
+        }
+        _coord_type dx[3] = { 0, 0, 0 }, ddx[3] = { 0, 0, 0 };
+        for (int k = 0; k < _dim; k++) {
+            dx[k] = state.dx[k][i];
+            ddx[k] = state.ddx[k][i];
+        }
+        v->dx = vector3d_type(dx[0], dx[1], dx[2]);
+        v->ddx = vector3d_type(ddx[0], ddx[1], ddx[2]);
+    }
+}
+
+
+template <typename _coord_type, int _dim, typename _force_model>
+_coord_type layer<_coord_type, _dim, _force_model>::layout(float_type dt)
+{
+    _coord_type max_ddx = 0;
+#pragma omp parallel
+    {
+#pragma omp single
+        layout_collect();
+        layout_move(dt);
+#pragma omp barrier
+#pragma omp single
+        {
+            layout_index();
+            max_ddx = layout_forces(dt);
+            layout_release();
+        }
+        layout_velocity(dt);
+    }
+    return max_ddx;
+}
+
+
+// calculate force/acceleration with Lagrange Dynamics
+template <typename _coord_type, int _dim, typename _force_model>
+_coord_type layer<_coord_type, _dim, _force_model>::layout_forces(float_type)
+{
+    _coord_type max_ddx = 0;
+    size_t n_vs = pvs.size();
+#pragma omp taskloop grainsize(64) reduction(max: max_ddx)
     for (size_t i = 0; i < n_vs; i++) {
-        auto v = vs[i];
-#ifndef REPULSION_BRUTE_FORCE
-        vector3d_type F_r = (n_vs > REPULSION_OCTREE_THRESHOLD? 
-            t->repulsion_force(v, f0, 1 / sqrt(eps)):
-            repulsion_force(v, vs));
-#else
-        vector3d_type F_r = repulsion_force(v, vs);
-#endif
+        auto v = pvs[i];
+        if (v->pinned) {
+            v->ddx_ = vector3d_type::zero;
+            continue;
+        }
+        vector3d_type F_r = repulsion(i);
         vector3d_type F_p = vector3d_type::zero;
         
-        // spring forces on v
+        // spring forces on v, exerted by active neighbours
         for (auto e : v->es) {
             if (e->a != e->b) {
                 vertex_type *v2 = (e->a == v)? e->b: e->a;
-                F_p += spring_force(v, v2, e);
+                if (v2->active) F_p += spring_force(v, v2, e);
             }
         }
 
@@ -160,88 +533,127 @@ _coord_type layer<_coord_type>::layout(float_type dt)
         v->ddx_ = F_r + F_p;
         max_ddx = std::max(max_ddx, v->ddx_.mod());
     }
-
-#ifndef REPULSION_BRUTE_FORCE
-    t->recycle();
-#endif
-
-#pragma omp parallel for
-    for (size_t i = 0; i < n_vs; i++) {
-        this->update_velocity(vs[i], dt);
-    }
-
     return max_ddx;
 }
 
 
-template <typename _coord_type>
-_coord_type finest_layer<_coord_type>::layout(float_type dt)
+// 
+// [Take centroid vertices of spline edges into consideration] We need to stuff all
+// vertices (including real vertices and virtual centroid vertices of spline edges)
+// into one unique vertex array, thus the following vertex layout algorithm will
+// operate on all kinds of vertices regardless of whether the vertex is a real
+// styled vertex or edge centroid vertex. Centroid vertices belong to the component
+// of their edges. The centroid of a spline edge is collected once, with its end
+// a, or with its end b when a is frozen outside of the region of interest.
+// 
+template <typename _coord_type, int _dim, typename _force_model>
+void finest_layer<_coord_type, _dim, _force_model>::collect_vertices(
+    vertex_array &pvs, vertex_array &owners)
 {
-    _coord_type max_ddx = 0;
-
-    // 
-    // [Take centroid vertices of spline edges into consideration] We need to stuff
-    // all vertices (including real vertices and virtual centroid vertices of spline
-    // edges) into one unique vertex array, thus the following vertex layout
-    // algorithm will operate on all kinds of vertices regardless of whether the
-    // vertex is a real styled vertex or edge centroid vertex.
-    // 
-    std::vector<vertex_type *> vs = this->vs;
-    for (auto v : this->vs) {
+    layer_type::collect_vertices(pvs, owners);
+    std::unordered_set<vertex_type *> region;
+    if (this->focused()) region.insert(owners.begin(), owners.end());
+    auto collected = [&](vertex_type *u) {
+        return !this->focused() or contains(region, u);
+    };
+
+    size_t n_vs = owners.size();
+    for (size_t i = 0; i < n_vs; i++) {
+        auto v = owners[i];
         for (auto e : v->es) {
-            auto e_styled = static_cast<edge_styled<_coord_type> *>(e);
+            auto e_styled = static_cast<edge_styled<_coord_type, _dim> *>(e);
             assert(e_styled != nullptr);
-            if (e_styled->spline and e->a == v) {
+            if (e_styled->spline and e->a->active and e->b->active and
+                (e->a == v or !collected(e->a))) {
                 if (!e_styled->vspline) e_styled->set_spline();
-                vs.push_back(e_styled->vspline);
+                if (spline_light) {
+                    centroids.push_back(e_styled->vspline);
+                }
+                else {
+                    pvs.push_back(e_styled->vspline);
+                    owners.push_back(v);
+                }
             }
         }
     }
-    
-    // move vertices with verlet integration on this layer
-    // for (auto v : vs) this->apply_displacement(v, dt);
-    size_t n_vs = vs.size();
-#pragma omp parallel for
-    for (size_t i = 0; i < n_vs; i++) {
-        this->apply_displacement(vs[i], dt);
+}
+
+
+// 
+// Force on the centroid c of a spline edge in lightweight mode: springs to both
+// ends of the edge, and repulsion from the ends and from a few centroids of other
+// spline edges sharing an end with it
+// 
+template <typename _coord_type, int _dim, typename _force_model>
+vector3d<_coord_type, _dim> finest_layer<_coord_type, _dim, _force_model>::
+centroid_force(vertex_type *c)
+{
+    vector3d_type F = vector3d_type::zero;
+    _coord_type reps = 2 / sqrt(this->eps);
+    auto repel = [&](const vertex_type *u) {
+        auto dx = c->x - u->x;
+        auto rdd = dx.rmod();
+        if (rdd < reps) {
+            F += _force_model::repulsion(
+                this->f0 * _force_model::mass(c) * _force_model::mass(u), rdd) * dx;
+        }
+    };
+
+    for (auto e : c->es) {
+        vertex_type *end = (e->a == c)? e->b: e->a;
+        F += this->spring_force(c, end, e);
+        repel(end);
+
+        int n_siblings = 0;
+        for (auto ee : end->es) {
+            auto ee_styled = static_cast<edge_styled<_coord_type, _dim> *>(ee);
+            if (ee_styled->spline and ee_styled->vspline and 
+                ee_styled->vspline != c) {
+                repel(ee_styled->vspline);
+                if (++n_siblings == spline_neighbours) break;
+            }
+        }
     }
+    return F;
+}
 
-#ifndef REPULSION_BRUTE_FORCE
-    // construct spatial octree
-    _coord_type x_min, x_max, y_min, y_max, z_min, z_max;
-    bounding_box(vs, x_min, x_max, y_min, y_max, z_min, z_max);
-    spatial_octree<_coord_type> *t = spatial_octree<_coord_type>::alloc(
-        nullptr, 
-        x_min, x_max, 
-        y_min, y_max, 
-        z_min, z_max);
-    for (auto v : vs) t->insert(v);
-#endif
+
+template <typename _coord_type, int _dim, typename _force_model>
+_coord_type finest_layer<_coord_type, _dim, _force_model>::layout_forces(float_type dt)
+{
+    _coord_type max_ddx = 0;
 
     // calculate force/acceleration with Lagrange Dynamics
-#pragma omp parallel for
+    auto &vs = this->pvs;
+    size_t n_vs = vs.size();
+#pragma omp taskloop grainsize(64) reduction(max: max_ddx)
     for (size_t i = 0; i < n_vs; i++) {
         auto v = vs[i];
-#ifndef REPULSION_BRUTE_FORCE
-        vector3d_type F_r = (n_vs > REPULSION_OCTREE_THRESHOLD?
-            t->repulsion_force(v, this->f0, 1 / sqrt(this->eps)):
-            this->repulsion_force(v, vs));
-#else
-        vector3d_type F_r = this->repulsion_force(v, vs);
-#endif
+        if (v->pinned) {
+            v->ddx_ = vector3d_type::zero;
+            continue;
+        }
+        vector3d_type F_r = this->repulsion(i);
         vector3d_type F_p = vector3d_type::zero;
 
-        // spring forces on v
-        for (auto e : v->es) {
-            auto e_styled = dynamic_cast<edge_styled<_coord_type> *>(e);
-            bool is_spline_edge = (e_styled and e_styled->spline);
-            if (e->a != e->b || is_spline_edge) {
-                vertex_type *v2 = nullptr;
-                if (is_spline_edge)
-                    v2 = e_styled->vspline;
-                else
-                    v2 = (e->a == v)? e->b: e->a;
-                F_p += this->spring_force(v, v2, e);
+        // spring forces on v, exerted by active neighbours. Parallel edges between
+        // styled vertices are aggregated into one spring, spline edges pull v
+        // towards their centroids, and centroids are pulled by both ends
+        auto v_styled = dynamic_cast<vertex_styled<_coord_type, _dim> *>(v);
+        if (v_styled) {
+            for (auto s : v_styled->springs) {
+                if (((s->a == v)? s->b: s->a)->active)
+                    F_p += this->spring_force(v, s);
+            }
+            for (auto e : v->es) {
+                auto e_styled = static_cast<edge_styled<_coord_type, _dim> *>(e);
+                if (e_styled->spline and ((e->a == v)? e->b: e->a)->active)
+                    F_p += this->spring_force(v, e_styled->vspline, e);
+            }
+        }
+        else {
+            for (auto e : v->es) {
+                F_p += this->spring_force(v, (e->a == v)? e->b: e->a, e);
             }
         }
 
@@ -250,14 +662,37 @@ _coord_type finest_layer<_coord_type>::layout(float_type dt)
         max_ddx = std::max(max_ddx, v->ddx_.mod());
     }
 
-#ifndef REPULSION_BRUTE_FORCE
-    t->recycle();
-#endif
-
-#pragma omp parallel for
-    for (size_t i = 0; i < n_vs; i++) {
-        this->update_velocity(vs[i], dt);
+    // centroids of spline edges in lightweight mode are moved every spline_interval
+    // iterations, and follow their ends in between
+    size_t n_centroids = centroids.size();
+    if (n_centroids and n_iterations % spline_interval == 0) {
+#pragma omp taskloop grainsize(1024)
+        for (size_t i = 0; i < n_centroids; i++) {
+            this->apply_displacement(centroids[i], dt);
+        }
+#pragma omp taskloop grainsize(64) reduction(max: max_ddx)
+        for (size_t i = 0; i < n_centroids; i++) {
+            auto c = centroids[i];
+            c->ddx_ = centroid_force(c);
+            max_ddx = std::max(max_ddx, c->ddx_.mod());
+        }
+#pragma omp taskloop grainsize(1024)
+        for (size_t i = 0; i < n_centroids; i++) {
+            this->update_velocity(centroids[i], dt);
+        }
+    }
+    else if (n_centroids) {
+#pragma omp taskloop grainsize(1024)
+        for (size_t i = 0; i < n_centroids; i++) {
+            auto c = centroids[i];
+            auto e_spline = static_cast<
+                typename edge_styled<_coord_type, _dim>::vertex_spline_centroid *>(c)
+                ->e_spline;
+            c->x += _coord_type(0.5) * (e_spline->a->delta + e_spline->b->delta);
+        }
     }
+    centroids.clear();
+    n_iterations += 1;
 
     return max_ddx;
 }
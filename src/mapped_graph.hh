@@ -0,0 +1,603 @@
+#ifndef _MAPPED_GRAPH_H_
+#define _MAPPED_GRAPH_H_
+
+
+#include "graph.hh"
+#include "layout.hh"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cstdint>
+#include <string>
+#include <system_error>
+#include <utility>
+
+
+// 
+// Array of trivially copyable objects kept in a memory mapped file, so that the
+// pages of the array are loaded and written back by the kernel as they are used.
+// The file is created if it doesn't exist, and is kept when the array is closed
+// 
+template <typename T>
+class mapped_array
+{
+public:
+    mapped_array(void) = default;
+    mapped_array(const mapped_array &) = delete;
+    ~mapped_array(void) { close(); }
+
+    // map the file at path, truncated or extended to n objects
+    void open(const std::string &path, size_t n)
+    {
+        close();
+        this->path = path;
+        fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+        if (fd < 0)
+            throw std::system_error(errno, std::system_category(), path);
+        resize(n);
+    }
+
+    void resize(size_t n)
+    {
+        unmap();
+        if (ftruncate(fd, n * sizeof(T)) != 0)
+            throw std::system_error(errno, std::system_category(), path);
+        this->n = n;
+        if (n == 0) return;
+        void *a = mmap(nullptr, n * sizeof(T), PROT_READ | PROT_WRITE, MAP_SHARED,
+            fd, 0);
+        if (a == MAP_FAILED)
+            throw std::system_error(errno, std::system_category(), path);
+        p = static_cast<T *>(a);
+    }
+
+    void close(void)
+    {
+        unmap();
+        if (fd >= 0) ::close(fd);
+        fd = -1;
+        n = 0;
+    }
+
+    // hint the kernel how the array is going to be accessed (MADV_SEQUENTIAL etc.)
+    void advise(int advice) {
+        if (p) madvise(p, n * sizeof(T), advice);
+    }
+
+    void swap(mapped_array &a) {
+        std::swap(path, a.path);
+        std::swap(fd, a.fd);
+        std::swap(p, a.p);
+        std::swap(n, a.n);
+    }
+
+    size_t size(void) const { return n; }
+    T *data(void) { return p; }
+    T &operator [] (size_t i) { return p[i]; }
+    const T &operator [] (size_t i) const { return p[i]; }
+
+private:
+    void unmap(void) {
+        if (p) munmap(p, n * sizeof(T));
+        p = nullptr;
+    }
+
+    std::string path;
+    int fd = -1;
+    T *p = nullptr;
+    size_t n = 0;
+};
+
+
+// 
+// Out-of-core storage for graphs too large to be kept as vertex and edge objects.
+// Vertex state and adjacency (in compressed sparse rows) live in memory mapped files
+// in a directory, so only the pages the layout is working on need to be resident.
+// 
+// Vertices are renumbered by the Morton code of their positions every
+// reorder_interval iterations (and after vertices or edges are added), so that
+// spatially close vertices are close in the files and the layout streams through
+// the files in spatially ordered blocks. An octree over the Morton order is kept in
+// memory: each node is a range of consecutive vertices, leaves have at most
+// leaf_size vertices, and the vertices in near leaves are read directly from the
+// files when computing repulsion. The whole tree down to the leaves is resident:
+// a node takes sizeof(node_type) bytes (80 for float, 120 for double), and there
+// are at least n / leaf_size leaves plus their ancestors, more where vertices are
+// unevenly spread. With the default leaf_size that's some 5 to a few tens of bytes
+// of RAM per vertex. The temporaries of renumbering and commit() are kept in
+// scratch files like the rest of the state.
+// 
+// Only a single layer is laid out, vertices have unit mass, and edges are plain
+// undirected springs. Vertices keep the ids they were added with, and can be copied
+// from and back to the finest layer of a graph. Files already in the directory are
+// overwritten
+// 
+template <typename _coord_type, int _dim = 3,
+          typename _force_model = spring_electrical>
+class mapped_graph
+{
+public:
+    typedef _coord_type float_type;
+    typedef vector3d<_coord_type, _dim> vector3d_type;
+    typedef graph<_coord_type, _dim, _force_model> graph_type;
+
+    mapped_graph(const std::string &dir,
+        float_type f0, float_type K, float_type eps, float_type damping)
+        : dir(dir), f0(f0), K(K), eps(eps), damping(damping) {
+        mkdir(dir.c_str(), 0755);
+        x.open(dir + "/x", 0);
+        dx.open(dir + "/dx", 0);
+        ddx.open(dir + "/ddx", 0);
+        ddx_.open(dir + "/ddx_", 0);
+        scratch.open(dir + "/x.tmp", 0);
+        ids.open(dir + "/ids", 0);
+        slots.open(dir + "/slots", 0);
+        codes.open(dir + "/codes", 0);
+        ranks.open(dir + "/ranks.tmp", 0);
+        ids_scratch.open(dir + "/ids.tmp", 0);
+        offsets.open(dir + "/offsets", 1);
+        offsets[0] = 0;
+        offsets_scratch.open(dir + "/offsets.tmp", 0);
+        fill_scratch.open(dir + "/fill.tmp", 0);
+        adj.open(dir + "/adj", 0);
+        adj_scratch.open(dir + "/adj.tmp", 0);
+        edges.open(dir + "/edges", 0);
+    }
+    mapped_graph(const mapped_graph &) = delete;
+
+    size_t n_vertices(void) const { return x.size(); }
+    size_t n_edges(void) const { return adj.size() / 2; }
+
+    // add n vertices at random positions, with ids following the existing ones
+    void add_vertices(size_t n)
+    {
+        size_t n0 = n_vertices(), n1 = n0 + n;
+        for (auto a : { &x, &dx, &ddx, &ddx_ }) a->resize(n1);
+        ids.resize(n1);
+        slots.resize(n1);
+        offsets.resize(n1 + 1);
+        for (size_t i = n0; i < n1; i++) {
+            set(x[i], vector3d_type(
+                rand_range(-5, 5), rand_range(-5, 5), rand_range(-5, 5)));
+            set(dx[i], vector3d_type::zero);
+            set(ddx[i], vector3d_type::zero);
+            ids[i] = slots[i] = i;
+            offsets[i + 1] = offsets[n0];
+        }
+        dirty = true;
+    }
+
+    // add an edge between vertices of ids a and b, it's included in the layout
+    // after commit()
+    void add_edge(size_t a, size_t b, float_type strength = 1.0)
+    {
+        if (n_edges_pending == edges.size())
+            edges.resize(std::max<size_t>(1024, 2 * edges.size()));
+        edges[n_edges_pending++] = edge_type { uint32_t(a), uint32_t(b), strength };
+    }
+
+    // merge added edges into the adjacency of vertices
+    void commit(void)
+    {
+        size_t n = n_vertices();
+        mapped_array<uint64_t> &degree = offsets_scratch, &fill = fill_scratch;
+        degree.resize(n + 1);
+        for (size_t i = 0; i < n; i++) degree[i] = offsets[i + 1] - offsets[i];
+        for (size_t k = 0; k < n_edges_pending; k++) {
+            const edge_type &e = edges[k];
+            if (e.a == e.b) continue;
+            degree[slots[e.a]] += 1;
+            degree[slots[e.b]] += 1;
+        }
+
+        // rows are copied into the scratch file, and then added edges are appended
+        adj_scratch.resize(adj.size() + 2 * n_edges_pending);
+        fill.resize(n);
+        uint64_t offset = 0;
+        for (size_t i = 0; i < n; i++) {
+            std::copy(adj.data() + offsets[i], adj.data() + offsets[i + 1],
+                adj_scratch.data() + offset);
+            fill[i] = offset + offsets[i + 1] - offsets[i];
+            offset += degree[i];
+        }
+        for (size_t k = 0; k < n_edges_pending; k++) {
+            const edge_type &e = edges[k];
+            if (e.a == e.b) continue;
+            uint32_t a = slots[e.a], b = slots[e.b];
+            adj_scratch[fill[a]++] = adjacency_type { b, e.strength };
+            adj_scratch[fill[b]++] = adjacency_type { a, e.strength };
+        }
+        adj_scratch.resize(offset);
+        adj.swap(adj_scratch);
+        for (size_t i = 0; i < n; i++) offsets[i + 1] = offsets[i] + degree[i];
+        degree.resize(0);
+        fill.resize(0);
+        n_edges_pending = 0;
+        edges.resize(0);
+        dirty = true;
+    }
+
+    vector3d_type position(size_t id) const { return get(x[slots[id]]); }
+
+    void set_position(size_t id, const vector3d_type &p) {
+        set(x[slots[id]], p);
+        dirty = true;
+    }
+
+    // copy vertices and edges of the finest layer of g after the existing vertices,
+    // the vertex g->g->vs[k] gets id first + k, where first is returned
+    size_t load(graph_type *g)
+    {
+        read_lock_guard l(g->lock);
+        auto &vs = g->g->vs;
+        std::unordered_map<const void *, size_t> index;
+        size_t n0 = n_vertices();
+        add_vertices(vs.size());
+        for (size_t k = 0; k < vs.size(); k++) {
+            index[vs[k]] = n0 + k;
+            set(x[n0 + k], vs[k]->x);
+        }
+        for (auto v : vs) {
+            for (auto e : v->es) {
+                if (e->a == v and index.count(e->b))
+                    add_edge(index[v], index[e->b], e->strength);
+            }
+        }
+        commit();
+        return n0;
+    }
+
+    // copy positions of vertices back into g, which must be the graph loaded with
+    // its first vertex at id first
+    void store(graph_type *g, size_t first = 0)
+    {
+        write_lock_guard l(g->lock);
+        auto &vs = g->g->vs;
+        for (size_t k = 0; k < vs.size() and first + k < n_vertices(); k++) {
+            vs[k]->x = get(x[slots[first + k]]);
+            vs[k]->dx = get(dx[slots[first + k]]);
+        }
+        g->g->generation += 1;
+    }
+
+    void bounding_box(
+        _coord_type &x_min, _coord_type &x_max,
+        _coord_type &y_min, _coord_type &y_max,
+        _coord_type &z_min, _coord_type &z_max) const
+    {
+        _coord_type lo[3], hi[3];
+        bounds(lo, hi);
+        x_min = lo[0]; x_max = hi[0];
+        y_min = lo[1]; y_max = hi[1];
+        z_min = lo[2]; z_max = hi[2];
+    }
+
+    // 
+    // Run an iteration of layout with time step dt, returns the maximum acceleration
+    // 
+    double layout(float_type dt)
+    {
+        size_t n = n_vertices();
+        if (n == 0) return 0;
+        if (dirty or ++n_iterations % reorder_interval == 0) {
+            reorder();
+            dirty = false;
+        }
+
+        for (auto a : { &x, &dx, &ddx, &ddx_ }) a->advise(MADV_SEQUENTIAL);
+#pragma omp parallel for schedule(static)
+        for (size_t i = 0; i < n; i++) {
+            vector3d_type delta = get(dx[i]) * dt +
+                (float_type(0.5) * dt * dt) * get(ddx[i]);
+            delta.bound(3);
+            set(x[i], get(x[i]) + delta);
+        }
+        update_tree();
+
+        // blocks of vertices are the leaves of the tree, in Morton order
+        double max_ddx = 0;
+        x.advise(MADV_NORMAL);
+#pragma omp parallel for schedule(dynamic) reduction(max: max_ddx)
+        for (size_t k = 0; k < leaves.size(); k++) {
+            const node_type &leaf = nodes[leaves[k]];
+            for (size_t i = leaf.first; i < leaf.last; i++) {
+                vector3d_type F = repulsion(0, i, get(x[i])) + spring_force(i);
+                set(ddx_[i], F);
+                max_ddx = std::max(max_ddx, (double) F.mod());
+            }
+        }
+
+#pragma omp parallel for schedule(static)
+        for (size_t i = 0; i < n; i++) {
+            vector3d_type v = get(dx[i]) + float_type(0.5) *
+                (get(ddx[i]) + get(ddx_[i])) * dt;
+            set(dx[i], damping * v);
+            ddx[i] = ddx_[i];
+        }
+        return max_ddx;
+    }
+
+    // iterations between renumbering of vertices. Renumbering sorts the vertices
+    // and rewrites their state, their ids and the whole adjacency, i.e. O(E) of file
+    // I/O, so it's done rarely. Vertices drift away from their blocks in between,
+    // which makes repulsion less cache friendly but not less accurate. Adding
+    // vertices or edges, or setting positions, renumbers on the next iteration
+    int reorder_interval = 50;
+    size_t leaf_size = 16;          // maximum number of vertices in a leaf
+
+private:
+    struct point_type { _coord_type c[_dim]; };
+    struct adjacency_type { uint32_t j; _coord_type strength; };
+    struct edge_type { uint32_t a, b; _coord_type strength; };
+
+    // Morton code of vertex i, sorted to renumber vertices
+    struct rank_type {
+        uint64_t code;
+        uint32_t i;
+        bool operator < (const rank_type &r) const {
+            return code < r.code or (code == r.code and i < r.i);
+        }
+    };
+
+    // node of the in-memory tree, its vertices are [first, last) and its children
+    // are nodes [child, child + n_children)
+    struct node_type {
+        vector3d_type c = vector3d_type::zero;
+        float_type mass = 0;
+        float_type lo[3], hi[3];    // bounding box
+        float_type rl = 0;          // reciprocal of the diagonal of the box
+        size_t first, last;
+        size_t child = 0;
+        int n_children = 0;
+    };
+
+    static const int code_bits = 63 / _dim;
+
+    static vector3d_type get(const point_type &p) {
+        _coord_type c[3] = { 0, 0, 0 };
+        for (int k = 0; k < _dim; k++) c[k] = p.c[k];
+        return vector3d_type(c[0], c[1], c[2]);
+    }
+
+    static void set(point_type &p, const vector3d_type &v) {
+        _coord_type c[3];
+        v.coord(c[0], c[1], c[2]);
+        for (int k = 0; k < _dim; k++) p.c[k] = c[k];
+    }
+
+    void bounds(_coord_type *lo, _coord_type *hi) const
+    {
+        for (int k = 0; k < 3; k++) lo[k] = hi[k] = 0;
+        for (size_t i = 0; i < n_vertices(); i++) {
+            for (int k = 0; k < _dim; k++) {
+                _coord_type c = x[i].c[k];
+                lo[k] = (i == 0)? c: std::min(lo[k], c);
+                hi[k] = (i == 0)? c: std::max(hi[k], c);
+            }
+        }
+    }
+
+    // interleave the quantized coordinates of p into a Morton code
+    uint64_t morton(const point_type &p, const _coord_type *lo,
+        const _coord_type *scale) const
+    {
+        uint64_t code = 0;
+        uint64_t q[_dim];
+        for (int k = 0; k < _dim; k++) q[k] = uint64_t((p.c[k] - lo[k]) * scale[k]);
+        for (int b = code_bits - 1; b >= 0; b--) {
+            for (int k = 0; k < _dim; k++) code = (code << 1) | ((q[k] >> b) & 1);
+        }
+        return code;
+    }
+
+    int digit(uint64_t code, int level) const {
+        return (code >> (_dim * (code_bits - 1 - level))) & ((1 << _dim) - 1);
+    }
+
+    // 
+    // Renumber vertices in Morton order of their positions, and rebuild the
+    // structure of the tree
+    // 
+    void reorder(void)
+    {
+        size_t n = n_vertices();
+        _coord_type lo[3], hi[3], scale[3];
+        bounds(lo, hi);
+        for (int k = 0; k < _dim; k++)
+            scale[k] = ((uint64_t(1) << code_bits) - 1) / std::max(hi[k] - lo[k],
+                _coord_type(1e-6));
+
+        mapped_array<rank_type> &order = ranks;
+        order.resize(n);
+#pragma omp parallel for schedule(static)
+        for (size_t i = 0; i < n; i++)
+            order[i] = rank_type { morton(x[i], lo, scale), uint32_t(i) };
+        std::sort(order.data(), order.data() + n);
+
+        scratch.resize(n);
+        for (auto a : { &x, &dx, &ddx }) {
+            for (size_t k = 0; k < n; k++) scratch[k] = (*a)[order[k].i];
+            a->swap(scratch);
+        }
+        ddx_.resize(n);
+        scratch.resize(0);
+
+        codes.resize(n);
+        ids_scratch.resize(n);
+        for (size_t k = 0; k < n; k++) {
+            codes[k] = order[k].code;
+            ids_scratch[k] = ids[order[k].i];
+            slots[ids_scratch[k]] = k;
+        }
+        ids.swap(ids_scratch);
+
+        // the scratch of ids is reused for the new numbers of vertices
+        mapped_array<uint32_t> &inv = ids_scratch;
+        for (size_t k = 0; k < n; k++) inv[order[k].i] = k;
+        adj_scratch.resize(adj.size());
+        offsets_scratch.resize(n + 1);
+        offsets_scratch[0] = 0;
+        for (size_t k = 0; k < n; k++) {
+            uint32_t i = order[k].i;
+            offsets_scratch[k + 1] = offsets_scratch[k] + offsets[i + 1] - offsets[i];
+            for (uint64_t p = offsets[i], q = offsets_scratch[k]; p < offsets[i + 1];
+                 p++) {
+                adj_scratch[q++] = adjacency_type { inv[adj[p].j], adj[p].strength };
+            }
+        }
+        adj.swap(adj_scratch);
+        adj_scratch.resize(0);
+        offsets.swap(offsets_scratch);
+        offsets_scratch.resize(0);
+        ids_scratch.resize(0);
+        order.resize(0);
+
+        nodes.clear();
+        leaves.clear();
+        nodes.resize(1);
+        build_node(0, 0, 0, n);
+    }
+
+    void build_node(size_t k, int level, size_t first, size_t last)
+    {
+        nodes[k].first = first;
+        nodes[k].last = last;
+        if (last - first <= leaf_size or level == code_bits) {
+            leaves.push_back(k);
+            return;
+        }
+
+        // vertices of a child share the next digit of their codes
+        std::vector<std::pair<size_t, size_t>> children;
+        for (size_t p = first; p < last; ) {
+            int d = digit(codes[p], level);
+            size_t q = p + 1;
+            while (q < last and digit(codes[q], level) == d) q++;
+            children.push_back({ p, q });
+            p = q;
+        }
+        nodes[k].child = nodes.size();
+        nodes[k].n_children = children.size();
+        nodes.resize(nodes.size() + children.size());
+        for (size_t c = 0; c < children.size(); c++) {
+            build_node(nodes[k].child + c, level + 1,
+                children[c].first, children[c].second);
+        }
+    }
+
+    // update centroids and bounding boxes of nodes with current positions, children
+    // are always placed after their parents
+    void update_tree(void)
+    {
+#pragma omp parallel for schedule(dynamic)
+        for (size_t k = 0; k < leaves.size(); k++) {
+            node_type &leaf = nodes[leaves[k]];
+            vector3d_type c = vector3d_type::zero;
+            for (int d = 0; d < 3; d++) leaf.lo[d] = leaf.hi[d] = 0;
+            for (size_t i = leaf.first; i < leaf.last; i++) {
+                c += get(x[i]);
+                for (int d = 0; d < _dim; d++) {
+                    leaf.lo[d] = (i == leaf.first)? x[i].c[d]:
+                        std::min(leaf.lo[d], x[i].c[d]);
+                    leaf.hi[d] = (i == leaf.first)? x[i].c[d]:
+                        std::max(leaf.hi[d], x[i].c[d]);
+                }
+            }
+            leaf.mass = leaf.last - leaf.first;
+            leaf.c = float_type(1 / leaf.mass) * c;
+        }
+        for (size_t k = nodes.size(); k-- > 0; ) {
+            node_type &node = nodes[k];
+            if (node.n_children == 0) continue;
+            vector3d_type c = vector3d_type::zero;
+            node.mass = 0;
+            for (int j = 0; j < node.n_children; j++) {
+                const node_type &child = nodes[node.child + j];
+                c += child.mass * child.c;
+                node.mass += child.mass;
+                for (int d = 0; d < 3; d++) {
+                    node.lo[d] = (j == 0)? child.lo[d]: std::min(node.lo[d], child.lo[d]);
+                    node.hi[d] = (j == 0)? child.hi[d]: std::max(node.hi[d], child.hi[d]);
+                }
+            }
+            node.c = float_type(1 / node.mass) * c;
+        }
+        for (auto &node : nodes) {
+            node.rl = vector3d_type(node.hi[0] - node.lo[0], node.hi[1] - node.lo[1],
+                node.hi[2] - node.lo[2]).rmod();
+        }
+    }
+
+    // repulsion on vertex i at xi exerted by vertices of node k
+    vector3d_type repulsion(size_t k, size_t i, const vector3d_type &xi) const
+    {
+        const node_type &node = nodes[k];
+        bool inside = (i >= node.first and i < node.last);
+        auto d = xi - node.c;
+        auto rdd = d.rmod();
+        if (!inside and rdd < node.rl)
+            return _force_model::repulsion(f0 * node.mass, rdd) * d;
+
+        vector3d_type F = vector3d_type::zero;
+        if (node.n_children == 0) {
+            float_type reps = 2 / sqrt(eps);
+            for (size_t j = node.first; j < node.last; j++) {
+                auto dj = xi - get(x[j]);
+                auto rddj = dj.rmod();
+                if (j == i) continue;
+                if (rddj <= reps) {
+                    F += _force_model::repulsion(f0, rddj) * dj;
+                }
+                else {
+                    // vertices (almost) coinciding push each other in random
+                    // directions, as in repulsion_brute_force
+                    F += vector3d_type(
+                        rand_range(-reps, reps),
+                        rand_range(-reps, reps),
+                        rand_range(-reps, reps));
+                }
+            }
+            return F;
+        }
+        for (int j = 0; j < node.n_children; j++) F += repulsion(node.child + j, i, xi);
+        return F;
+    }
+
+    vector3d_type spring_force(size_t i) const
+    {
+        vector3d_type F = vector3d_type::zero;
+        vector3d_type xi = get(x[i]);
+        for (uint64_t p = offsets[i]; p < offsets[i + 1]; p++) {
+            auto d = xi - get(x[adj[p].j]);
+            F -= _force_model::attraction(K, adj[p].strength, d) * d;
+        }
+        return F;
+    }
+
+
+    std::string dir;
+    float_type f0, K, eps, damping;
+    bool dirty = true;
+    int n_iterations = 0;
+    size_t n_edges_pending = 0;
+
+    // vertex state, indexed by the current number of a vertex
+    mapped_array<point_type> x, dx, ddx, ddx_, scratch;
+    mapped_array<uint32_t> ids;         // id of a vertex
+    mapped_array<uint32_t> slots;       // current number of the vertex of an id
+    mapped_array<uint64_t> codes;       // Morton codes at last renumbering
+    mapped_array<rank_type> ranks;      // scratch of renumbering
+    mapped_array<uint32_t> ids_scratch;
+
+    // adjacency of vertex i is adj[offsets[i], offsets[i + 1])
+    mapped_array<uint64_t> offsets, offsets_scratch, fill_scratch;
+    mapped_array<adjacency_type> adj, adj_scratch;
+    mapped_array<edge_type> edges;      // edges added since last commit()
+
+    std::vector<node_type> nodes;
+    std::vector<size_t> leaves;
+};
+
+
+#endif /* _MAPPED_GRAPH_H_ */
@@ -0,0 +1,109 @@
+#ifndef _MUTATION_QUEUE_H_
+#define _MUTATION_QUEUE_H_
+
+
+#include <atomic>
+#include <functional>
+#include <future>
+#include <memory>
+
+
+// 
+// Multiple producer single consumer queue of mutations. Producers push without
+// locking (a CAS on the head of a linked list of mutations), and the consumer takes
+// all pending mutations at once by swapping the head out, then runs them in the
+// order they were pushed. Each mutation carries a completion callback, which is run
+// after the whole batch of mutations taken with it
+// 
+class mutation_queue
+{
+public:
+    typedef std::function<void(void)> task_type;
+
+    mutation_queue(void) = default;
+    mutation_queue(const mutation_queue &) = delete;
+    ~mutation_queue(void) {
+        dispose(take_all());
+    }
+
+    // push a mutation, done is called once the mutation is applied
+    void push(task_type apply, task_type done)
+    {
+        node *n = new node { std::move(apply), std::move(done), nullptr };
+        n->next = head.load(std::memory_order_relaxed);
+        while (!head.compare_exchange_weak(n->next, n,
+                std::memory_order_release, std::memory_order_relaxed));
+    }
+
+    // push a mutation, the returned future is ready once the mutation is applied
+    std::future<void> push(task_type apply)
+    {
+        auto p = std::make_shared<std::promise<void>>();
+        std::future<void> f = p->get_future();
+        push(std::move(apply), [p]() { p->set_value(); });
+        return f;
+    }
+
+    bool empty(void) const {
+        return head.load(std::memory_order_relaxed) == nullptr;
+    }
+
+    // 
+    // Take all pending mutations and apply them in the order they were pushed. The
+    // mutations are applied by apply_all(run), where run() applies each of them in
+    // turn, so that the caller can lock the graph once around the batch. Returns the
+    // number of mutations applied
+    // 
+    template <typename _apply_all_type>
+    size_t consume(_apply_all_type apply_all)
+    {
+        node *first = take_all();
+        if (!first) return 0;
+        size_t n = 0;
+        apply_all([&]() {
+                for (node *p = first; p; p = p->next) {
+                    p->apply();
+                    n += 1;
+                }
+            });
+        for (node *p = first; p; p = p->next) {
+            if (p->done) p->done();
+        }
+        dispose(first);
+        return n;
+    }
+
+protected:
+    struct node {
+        task_type apply;
+        task_type done;
+        node *next;
+    };
+
+    // detach pending mutations from the queue, oldest first
+    node *take_all(void)
+    {
+        node *p = head.exchange(nullptr, std::memory_order_acquire), *first = nullptr;
+        while (p) {
+            node *next = p->next;
+            p->next = first;
+            first = p;
+            p = next;
+        }
+        return first;
+    }
+
+    static void dispose(node *p)
+    {
+        while (p) {
+            node *next = p->next;
+            delete p;
+            p = next;
+        }
+    }
+
+    std::atomic<node *> head { nullptr };
+};
+
+
+#endif /* _MUTATION_QUEUE_H_ */
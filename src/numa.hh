@@ -0,0 +1,188 @@
+#ifndef _NUMA_H_
+#define _NUMA_H_
+
+
+#include <vector>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <type_traits>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+
+// 
+// Placement of layout threads and memory on NUMA machines. Threads are pinned to
+// the configured lists of CPUs (empty lists leave them alone). The integration
+// state of each layer (see layer::state) is split into contiguous ranges, one per
+// worker of the OpenMP team running layout, and each range is first touched by
+// the worker that owns it, so that its pages live on the node of that worker
+// instead of the node of the thread allocating them. Large arrays can also be
+// backed by transparent huge pages to save TLB misses
+// 
+struct numa_config
+{
+    std::vector<int> layout_cpus;   // CPUs of the layout thread and its workers
+    std::vector<int> render_cpus;   // CPUs of the render thread
+    bool first_touch = true;        // place layout state on the owning workers
+    bool huge_pages = false;        // back large arrays with huge pages
+};
+
+
+// configuration used by numa_allocator, set up by galaster_run
+inline numa_config &numa_settings(void)
+{
+    static numa_config config;
+    return config;
+}
+
+
+// pin the calling thread to specified CPUs, an empty list is a no-op
+inline bool numa_pin_thread(const std::vector<int> &cpus)
+{
+    if (cpus.empty()) return true;
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu : cpus) CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+    return false;
+#endif
+}
+
+
+// 
+// range [first, last) of n elements owned by the calling thread. The elements are
+// split into as many contiguous ranges as the threads of the team, so that loops
+// over the same elements by the same team always give each thread the same range
+// 
+inline void numa_static_range(size_t n, size_t &first, size_t &last)
+{
+#ifdef _OPENMP
+    size_t t = (size_t) omp_get_thread_num();
+    size_t n_threads = (size_t) omp_get_num_threads();
+#else
+    size_t t = 0, n_threads = 1;
+#endif
+    first = n * t / n_threads;
+    last = n * (t + 1) / n_threads;
+}
+
+
+// 
+// Allocator for large arrays used by layout. Arrays smaller than large_array_size
+// are allocated as usual, larger ones are page aligned and advised to use huge
+// pages according to numa_settings(). Pages aren't touched here: where they end up
+// is decided by the first thread writing them
+// 
+template <typename T>
+class numa_allocator
+{
+public:
+    typedef T value_type;
+    static const size_t large_array_size = 1 << 20;
+    static const size_t huge_page_size = 1 << 21;
+
+    numa_allocator(void) = default;
+    template <typename U>
+    numa_allocator(const numa_allocator<U> &) {}
+
+    T *allocate(size_t n)
+    {
+        size_t bytes = n * sizeof(T);
+        if (bytes < large_array_size) {
+            return static_cast<T *>(::operator new(bytes));
+        }
+
+        const numa_config &config = numa_settings();
+        size_t page = page_size();
+        size_t align = config.huge_pages? huge_page_size: page;
+        void *p = nullptr;
+        if (posix_memalign(&p, align, bytes) != 0) throw std::bad_alloc();
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+        if (config.huge_pages) madvise(p, bytes, MADV_HUGEPAGE);
+#endif
+        return static_cast<T *>(p);
+    }
+
+    void deallocate(T *p, size_t n)
+    {
+        if (n * sizeof(T) < large_array_size) ::operator delete(p);
+        else free(p);
+    }
+
+private:
+    static size_t page_size(void) {
+#ifdef __linux__
+        return (size_t) sysconf(_SC_PAGESIZE);
+#else
+        return 4096;
+#endif
+    }
+};
+
+template <typename T, typename U>
+bool operator == (const numa_allocator<T> &, const numa_allocator<U> &) {
+    return true;
+}
+
+template <typename T, typename U>
+bool operator != (const numa_allocator<T> &, const numa_allocator<U> &) {
+    return false;
+}
+
+
+// 
+// Array of plain values kept across layout iterations. Unlike std::vector, growing
+// it doesn't initialize (and thus touch) the new storage: elements are undefined
+// until written, so that each page is first touched by the worker writing it in a
+// `schedule(static)` loop, which is also the worker reading and writing it in the
+// loops of later iterations. With first_touch disabled, the allocating thread
+// touches the whole array instead
+// 
+template <typename T>
+class numa_array
+{
+public:
+    static_assert(std::is_trivially_copyable<T>::value, "numa_array of plain values");
+
+    numa_array(void) = default;
+    numa_array(const numa_array &) = delete;
+    numa_array &operator = (const numa_array &) = delete;
+    ~numa_array(void) { if (p) numa_allocator<T>().deallocate(p, cap); }
+
+    // make room for n elements, returns true if the storage was reallocated (and
+    // its elements are undefined)
+    bool resize(size_t n)
+    {
+        this->n = n;
+        if (n <= cap) return false;
+        if (p) numa_allocator<T>().deallocate(p, cap);
+        cap = std::max(n, cap + cap / 2);
+        p = numa_allocator<T>().allocate(cap);
+        if (!numa_settings().first_touch) memset((void *) p, 0, cap * sizeof(T));
+        return true;
+    }
+
+    size_t size(void) const { return n; }
+    T *data(void) { return p; }
+    const T *data(void) const { return p; }
+    T &operator [] (size_t i) { return p[i]; }
+    const T &operator [] (size_t i) const { return p[i]; }
+
+private:
+    T *p = nullptr;
+    size_t n = 0, cap = 0;
+};
+
+
+#endif /* _NUMA_H_ */
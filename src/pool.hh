@@ -0,0 +1,88 @@
+#ifndef _POOL_H_
+#define _POOL_H_
+
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+
+// 
+// Pool of objects of one type. Objects are carved out of chunks of _chunk_size
+// objects, destroyed objects go to a free list and are reused most recently freed
+// first, so that churning objects keeps reusing the same (cached) memory instead of
+// going through the heap. Chunks are only released, all at once, when the pool is
+// destroyed, its objects must be destroyed by then. Not thread safe
+// 
+template <typename _object_type, size_t _chunk_size = 1024>
+class object_pool
+{
+public:
+    object_pool(void) = default;
+    object_pool(const object_pool &) = delete;
+    ~object_pool(void) {
+        for (auto c : chunks) delete [] c;
+    }
+
+    template <typename... _args_type>
+    _object_type *create(_args_type &&... args)
+    {
+        void *p = allocate();
+        try {
+            return ::new (p) _object_type(std::forward<_args_type>(args)...);
+        }
+        catch (...) {
+            release(p);
+            throw;
+        }
+    }
+
+    void destroy(_object_type *p)
+    {
+        p->~_object_type();
+        release(p);
+    }
+
+    // number of live objects
+    size_t size(void) const { return n_live; }
+
+protected:
+    union block {
+        block *next;
+        typename std::aligned_storage<
+            sizeof(_object_type), alignof(_object_type)>::type storage;
+    };
+
+    void *allocate(void)
+    {
+        if (!free_list) {
+            block *c = new block[_chunk_size];
+            chunks.push_back(c);
+            for (size_t i = _chunk_size; i-- > 0; ) {
+                c[i].next = free_list;
+                free_list = &c[i];
+            }
+        }
+        block *b = free_list;
+        free_list = b->next;
+        n_live += 1;
+        return b;
+    }
+
+    void release(void *p)
+    {
+        block *b = static_cast<block *>(p);
+        b->next = free_list;
+        free_list = b;
+        n_live -= 1;
+    }
+
+    std::vector<block *> chunks;
+    block *free_list = nullptr;
+    size_t n_live = 0;
+};
+
+
+#endif /* _POOL_H_ */
@@ -5,6 +5,7 @@
 #define GLFW_INCLUDE_GLU
 #include <GLFW/glfw3.h>
 #include "vertex_edge.hh"
+#include "vec_batch.hh"
 #include <iostream>
 
 
@@ -44,6 +45,33 @@ struct _edgearrayelement {
     GLfloat x, y, z;
 };
 
+// 
+// corners of billboards of n particles at (px, py, pz) with sizes ps, given the
+// corner offsets ql and qr of a particle of size 1 (see vec_batch.hh for the
+// dispatch)
+// 
+VEC_BATCH_KERNEL inline void batch_billboards(
+    const GLfloat *px, const GLfloat *py, const GLfloat *pz, const GLfloat *ps,
+    size_t n, const GLfloat *ql, const GLfloat *qr, _vertexarrayelement *varr)
+{
+#pragma omp simd
+    for (size_t i = 0; i < n; i++) {
+        GLfloat x = px[i], y = py[i], z = pz[i];
+        GLfloat vqlx = ql[0] * ps[i];
+        GLfloat vqly = ql[1] * ps[i];
+        GLfloat vqlz = ql[2] * ps[i];
+        GLfloat vqrx = qr[0] * ps[i];
+        GLfloat vqry = qr[1] * ps[i];
+        GLfloat vqrz = qr[2] * ps[i];
+        _vertexarrayelement *vptr = &varr[4 * i];
+        vptr[0].x = x + vqlx; vptr[0].y = y + vqly; vptr[0].z = z + vqlz;
+        vptr[1].x = x + vqrx; vptr[1].y = y + vqry; vptr[1].z = z + vqrz;
+        vptr[2].x = x - vqlx; vptr[2].y = y - vqly; vptr[2].z = z - vqlz;
+        vptr[3].x = x - vqrx; vptr[3].y = y - vqry; vptr[3].z = z - vqrz;
+    }
+}
+
+
 static GLuint particle_tex_id;  // Texture object IDs
 #define PARTICLE_SIZE 2.5f
 #define P_TEX_WIDTH  16         // Particle texture dimensions
@@ -101,8 +129,8 @@ inline void init_particle_system(void)
 // Render edges with vertex arrays. Note that spline edges are rendered straight and
 // line width/stipple settings are ignored
 // 
-template <typename _coord_type>
-void graph<_coord_type>::render_particle_edges(void)
+template <typename _coord_type, int _dim, typename _force_model>
+void graph<_coord_type, _dim, _force_model>::render_particle_edges(void)
 {
     static int edgearray_len = 100;
     static _edgearrayelement *edge_arr = (_edgearrayelement *) malloc(
@@ -112,7 +140,7 @@ void graph<_coord_type>::render_particle_edges(void)
     for (auto v : g->vs) {
         for (auto e : v->es) {
             if (e->a == v) {
-                auto estyled = static_cast<edge_styled<_coord_type> *>(e);
+                auto estyled = static_cast<edge_styled<_coord_type, _dim> *>(e);
                 _edgearrayelement *eptr = nullptr;
                 if (i_edge_arr < edgearray_len - 1) {
                     eptr = &edge_arr[i_edge_arr];
@@ -124,8 +152,8 @@ void graph<_coord_type>::render_particle_edges(void)
                         edgearray_len * sizeof(_edgearrayelement));
                     eptr = &edge_arr[i_edge_arr];
                 }
-                auto a = static_cast<vertex_styled<_coord_type>* >(estyled->a);
-                auto b = static_cast<vertex_styled<_coord_type>* >(estyled->b);
+                auto a = static_cast<vertex_styled<_coord_type, _dim>* >(estyled->a);
+                auto b = static_cast<vertex_styled<_coord_type, _dim>* >(estyled->b);
                 _coord_type x0, y0, z0, x1, y1, z1;
                 a->x.coord(x0, y0, z0);
                 b->x.coord(x1, y1, z1);
@@ -163,8 +191,8 @@ void graph<_coord_type>::render_particle_edges(void)
 // Render vertices as particles with vertex arrays, vertex shape is ignored and all
 // vertices are rendered using the same texture
 // 
-template <typename _coord_type>
-void graph<_coord_type>::render_particle_vertices(GLfloat *modelview)
+template <typename _coord_type, int _dim, typename _force_model>
+void graph<_coord_type, _dim, _force_model>::render_particle_vertices(GLfloat *modelview)
 {
     static int vertarray_len = 0;
     static _vertexarrayelement *vertex_arr = nullptr;
@@ -181,63 +209,37 @@ void graph<_coord_type>::render_particle_vertices(GLfloat *modelview)
     size_t n_vertices = g->vs.size();
     if (!vertex_arr or vertarray_len < n_vertices * 4) {
         vertarray_len = n_vertices * 4;
-        delete vertex_arr;
+        free(vertex_arr);
         vertex_arr = (_vertexarrayelement *)
             malloc(vertarray_len * sizeof(_vertexarrayelement));
     }
 
-    _vertexarrayelement *vptr = vertex_arr;
+    // gather positions and sizes of vertices, then compute the corners of their
+    // billboards with a batch kernel
+    auto &pos = particle_pos;
+    auto &sizes = particle_sizes;
+    pos.resize(n_vertices);
+    sizes.resize(n_vertices);
     for (size_t i = 0; i < n_vertices; i++) {
-        auto v = static_cast<vertex_styled<_coord_type> *>(g->vs[i]);
+        auto v = static_cast<vertex_styled<_coord_type, _dim> *>(g->vs[i]);
         _coord_type _x, _y, _z;
         v->x.coord(_x, _y, _z);
-        GLfloat x = _x, y = _y, z = _z;
-            
+        pos.set(i, _x, _y, _z);
+        sizes[i] = v->size;
+
         GLuint rgba = v->color.c4u();
-        GLfloat vqlx = qlx * v->size;
-        GLfloat vqly = qly * v->size;
-        GLfloat vqlz = qlz * v->size;
-        GLfloat vqrx = qrx * v->size;
-        GLfloat vqry = qry * v->size;
-        GLfloat vqrz = qrz * v->size;
-        
-        // Lower left corner
-        vptr->s    = 0.f;
-        vptr->t    = 0.f;
-        vptr->rgba = rgba;
-        vptr->x    = x + vqlx;
-        vptr->y    = y + vqly;
-        vptr->z    = z + vqlz;
-        vptr ++;
-
-        // Lower right corner
-        vptr->s    = 1.f;
-        vptr->t    = 0.f;
-        vptr->rgba = rgba;
-        vptr->x    = x + vqrx;
-        vptr->y    = y + vqry;
-        vptr->z    = z + vqrz;
-        vptr ++;
-
-        // Upper right corner
-        vptr->s    = 1.f;
-        vptr->t    = 1.f;
-        vptr->rgba = rgba;
-        vptr->x    = x - vqlx;
-        vptr->y    = y - vqly;
-        vptr->z    = z - vqlz;
-        vptr ++;
-
-        // Upper left corner
-        vptr->s    = 0.f;
-        vptr->t    = 1.f;
-        vptr->rgba = rgba;
-        vptr->x    = x - vqrx;
-        vptr->y    = y - vqry;
-        vptr->z    = z - vqrz;
-        vptr ++;
+        _vertexarrayelement *vptr = &vertex_arr[4 * i];
+        vptr[0].s = 0.f; vptr[0].t = 0.f;   // lower left corner
+        vptr[1].s = 1.f; vptr[1].t = 0.f;   // lower right corner
+        vptr[2].s = 1.f; vptr[2].t = 1.f;   // upper right corner
+        vptr[3].s = 0.f; vptr[3].t = 1.f;   // upper left corner
+        for (int k = 0; k < 4; k++) vptr[k].rgba = rgba;
     }
 
+    const GLfloat ql[3] = { qlx, qly, qlz }, qr[3] = { qrx, qry, qrz };
+    batch_billboards(pos[0], pos[1], pos[2], sizes.data(), n_vertices, ql, qr,
+        vertex_arr);
+
     glEnable(GL_TEXTURE_2D);
     glBlendFunc(GL_SRC_ALPHA, GL_ONE);
     glInterleavedArrays(GL_T2F_C4UB_V3F, 0, vertex_arr);
@@ -254,13 +256,13 @@ void graph<_coord_type>::render_particle_vertices(GLfloat *modelview)
 // Rendering vertex and edge labels, this might be the slowest part of the renderer,
 // so please don't add too much labels to your graph
 // 
-template <typename _coord_type>
-void graph<_coord_type>::render_particle_labels(GLfloat *modelview)
+template <typename _coord_type, int _dim, typename _force_model>
+void graph<_coord_type, _dim, _force_model>::render_particle_labels(GLfloat *modelview)
 {
     // render vertex text labels
     for (auto v : g->vs) {
         glLoadMatrixf(modelview);
-        auto vstyled = static_cast<vertex_styled<_coord_type> *>(v);
+        auto vstyled = static_cast<vertex_styled<_coord_type, _dim> *>(v);
         if (!vstyled->label.empty()) {
             _coord_type x, y, z;
             glColor3d(
@@ -279,11 +281,11 @@ void graph<_coord_type>::render_particle_labels(GLfloat *modelview)
         glLoadMatrixf(modelview);
         for (auto e : v->es) {
             if (e->a == v) {
-                auto estyled = static_cast<edge_styled<_coord_type> *>(e);
+                auto estyled = static_cast<edge_styled<_coord_type, _dim> *>(e);
                 if (!estyled->label.empty()) {
                     _coord_type x, y, z, x0, y0, z0, x1, y1, z1;
-                    auto a = static_cast<vertex_styled<_coord_type> *>(e->a);
-                    auto b = static_cast<vertex_styled<_coord_type> *>(e->b);
+                    auto a = static_cast<vertex_styled<_coord_type, _dim> *>(e->a);
+                    auto b = static_cast<vertex_styled<_coord_type, _dim> *>(e->b);
                     a->x.coord(x0, y0, z0);
                     b->x.coord(x1, y1, z1);
                     x = 0.5 * (x0 + x1);
@@ -307,8 +309,8 @@ void graph<_coord_type>::render_particle_labels(GLfloat *modelview)
 // Render this graph using particle system, this renderer is much faster than solid
 // rendering system and performs well when visualizing large graphs (N > 5000)
 // 
-template <typename _coord_type>
-void graph<_coord_type>::render_particle(GLfloat *modelview)
+template <typename _coord_type, int _dim, typename _force_model>
+void graph<_coord_type, _dim, _force_model>::render_particle(GLfloat *modelview)
 {
     static bool particle_initialized = false;
     if (!particle_initialized) {
@@ -330,17 +332,17 @@ void graph<_coord_type>::render_particle(GLfloat *modelview)
 // Render the graph using traditional solid body rendering system, the render effect
 // is identical with ubigraph, but way slower than particle system
 // 
-template <typename _coord_type>
-void graph<_coord_type>::render_solid(GLfloat *modelview)
+template <typename _coord_type, int _dim, typename _force_model>
+void graph<_coord_type, _dim, _force_model>::render_solid(GLfloat *modelview)
 {
     glEnable(GL_DEPTH_TEST);
     for (auto v : g->vs) {
         glLoadMatrixf(modelview);
-        static_cast<vertex_styled<_coord_type> *>(v)->render();
+        static_cast<vertex_styled<_coord_type, _dim> *>(v)->render();
         for (auto e : v->es) {
             if (e->a == v) {
                 glLoadMatrixf(modelview);
-                static_cast<edge_styled<_coord_type> *>(e)->render();
+                static_cast<edge_styled<_coord_type, _dim> *>(e)->render();
             }
         }
     }
@@ -351,8 +353,8 @@ void graph<_coord_type>::render_solid(GLfloat *modelview)
 // Render graph using OpenGL by rendering each individual vertices and edges. Note
 // that the modelview matrix will not be affected after calling this function
 // 
-template <typename _coord_type>
-void graph<_coord_type>::render(renderer method)
+template <typename _coord_type, int _dim, typename _force_model>
+void graph<_coord_type, _dim, _force_model>::render(renderer method)
 {
     GLfloat modelview[4 * 4];
     glGetFloatv(GL_MODELVIEW_MATRIX, modelview);
@@ -375,8 +377,8 @@ void graph<_coord_type>::render(renderer method)
 
 
 // Render this vertex using OpenGL
-template <typename _coord_type>
-void vertex_styled<_coord_type>::render(void) const
+template <typename _coord_type, int _dim>
+void vertex_styled<_coord_type, _dim>::render(void) const
 {
     if (!visible) return;
     _coord_type x, y, z;
@@ -434,8 +436,8 @@ void vertex_styled<_coord_type>::render(void) const
 
 
 // Render this edge using OpenGL
-template <typename _coord_type>
-void edge_styled<_coord_type>::render(void) const
+template <typename _coord_type, int _dim>
+void edge_styled<_coord_type, _dim>::render(void) const
 {
     if (!visible) return;
     if (!spline and this->a == this->b) return;
@@ -456,15 +458,16 @@ void edge_styled<_coord_type>::render(void) const
     glLineWidth(width);
     glColor3d(color.redd(), color.greend(), color.blued());
 
-    vector3d_type arrow_dir(vector3d_type::zero);
+    // arrows are always oriented in 3D space, even for planar layouts
+    vector3d<_coord_type, 3> arrow_dir(vector3d<_coord_type, 3>::zero);
     _coord_type ax = 0, ay = 0, az = 0;
     _coord_type label_x = 0, label_y = 0, label_z = 0;
 
     if (!spline) {
         glDisable(GL_LIGHTING);
         if (blendcolor) {
-            auto a = static_cast<vertex_styled<_coord_type>* >(this->a);
-            auto b = static_cast<vertex_styled<_coord_type>* >(this->b);
+            auto a = static_cast<vertex_styled<_coord_type, _dim>* >(this->a);
+            auto b = static_cast<vertex_styled<_coord_type, _dim>* >(this->b);
             glEnable(GL_BLEND);
             glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
             glBegin(GL_LINES);
@@ -486,7 +489,9 @@ void edge_styled<_coord_type>::render(void) const
         // calculate arrow position and direction
         if (arrow) {
             vector3d_type dvertex = this->b->x - this->a->x;
-            arrow_dir = dvertex.normalized();
+            _coord_type dx, dy, dz;
+            dvertex.normalized().coord(dx, dy, dz);
+            arrow_dir = vector3d<_coord_type, 3>(dx, dy, dz);
             (this->a->x + dvertex * (_coord_type) arrow_position).coord(ax, ay, az);
         }
 
@@ -520,7 +525,8 @@ void edge_styled<_coord_type>::render(void) const
                 ownglEvalCoord1f(3, 3, &ctrl_pts[0][0], arrow_position, axf, ayf, azf);
                 ownglEvalCoord1f(3, 3, &ctrl_pts[0][0], arrow_position + 0.1, x1, y1, z1);
                 ax = (_coord_type) axf, ay = (_coord_type) ayf, az = (_coord_type) azf;
-                arrow_dir = vector3d_type(x1 - ax, y1 - ay, z1 - az).normalized();
+                arrow_dir = vector3d<_coord_type, 3>(
+                    x1 - ax, y1 - ay, z1 - az).normalized();
             }
 
             if (!label.empty()) {
@@ -560,7 +566,8 @@ void edge_styled<_coord_type>::render(void) const
                 ownglEvalCoord1f(3, 4, &ctrl_pts[0][0], arrow_position, axf, ayf, azf);
                 ownglEvalCoord1f(3, 4, &ctrl_pts[0][0], arrow_position + 0.1, x1, y1, z1);
                 ax = (_coord_type) axf, ay = (_coord_type) ayf, az = (_coord_type) azf;
-                arrow_dir = vector3d_type(x1 - ax, y1 - ay, z1 - az).normalized();
+                arrow_dir = vector3d<_coord_type, 3>(
+                    x1 - ax, y1 - ay, z1 - az).normalized();
             }
 
             // calculate text label position
@@ -585,17 +592,18 @@ void edge_styled<_coord_type>::render(void) const
 
 
 // Render arrows as solid cones
-template <typename _coord_type>
-void edge_styled<_coord_type>::render_arrow(
-    const vector3d_type &arrow_dir, GLfloat ax, GLfloat ay, GLfloat az) const
+template <typename _coord_type, int _dim>
+void edge_styled<_coord_type, _dim>::render_arrow(
+    const vector3d<_coord_type, 3> &arrow_dir,
+    GLfloat ax, GLfloat ay, GLfloat az) const
 {
     if (arrow) {
         glTranslatef(ax, ay, az);
-        auto zvec_dir = vector3d_type(0, 0, 1);
+        auto zvec_dir = vector3d<_coord_type, 3>(0, 0, 1);
         _coord_type rot_angle = acos(arrow_dir.dot(zvec_dir));
         if (fabs(rot_angle) > 1e-6) {
             _coord_type rx, ry, rz;
-            vector3d_type rot_axis = arrow_dir.cross(zvec_dir).normalized();
+            auto rot_axis = arrow_dir.cross(zvec_dir).normalized();
             rot_axis.coord(rx, ry, rz);
             glRotatef(-rot_angle * 180 / M_PI, rx, ry, rz);
         }
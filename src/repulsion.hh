@@ -0,0 +1,407 @@
+#ifndef _REPULSION_H_
+#define _REPULSION_H_
+
+
+#include "spatial_octree.hh"
+#include "vec_batch.hh"
+#include <chrono>
+#include <cstring>
+#include <mutex>
+#include <memory>
+#include <string>
+
+
+// 
+// Default crossover between brute force and octree repulsion, which is used until
+// the backends are calibrated on this machine. Define REPULSION_BRUTE_FORCE to
+// always compute repulsion by brute force.
+// 
+// #define REPULSION_BRUTE_FORCE
+#define REPULSION_OCTREE_THRESHOLD 2000
+
+
+// 
+// A set of vertices repelling each other. The layer fills in the vertex range, the
+// bounding box and the force parameters, the backend keeps whatever it builds from
+// them in `state`
+// 
+template <typename _coord_type, int _dim = 3>
+struct repulsion_domain
+{
+    vertex<_coord_type, _dim> * const *begin;
+    vertex<_coord_type, _dim> * const *end;
+    _coord_type x_min, x_max, y_min, y_max, z_min, z_max;
+    _coord_type f0, eps;
+    void *state;
+};
+
+
+// 
+// A point mass standing in for a vertex in a repulsion domain, e.g. a copy of a
+// vertex owned by another process, or of a frozen vertex. Domains of proxies use
+// proxy_model, which takes the masses of the proxies instead of computing them
+// from their vertices
+// 
+template <typename _coord_type, int _dim = 3>
+struct repulsion_proxy : public vertex<_coord_type, _dim>
+{
+    repulsion_proxy(void) : vertex<_coord_type, _dim>(0, 0, 0) {}
+    _coord_type m = 1;
+};
+
+template <typename _force_model>
+struct proxy_model : public _force_model
+{
+    template <typename _coord_type, int _dim>
+    static _coord_type mass(const vertex<_coord_type, _dim> *v) {
+        return static_cast<const repulsion_proxy<_coord_type, _dim> *>(v)->m;
+    }
+};
+
+
+// 
+// Interface of algorithms computing repulsion forces among vertices of a domain.
+// Implementations are parameterized on the force model, so only the choice of
+// backend is dispatched dynamically, not the force kernel.
+// complexity() gives the shape of the cost function of a domain with n vertices,
+// the constant factor is measured by repulsion_registry::calibrate
+// 
+template <typename _coord_type, int _dim = 3>
+class repulsion_backend
+{
+public:
+    typedef vertex<_coord_type, _dim> vertex_type;
+    typedef vector3d<_coord_type, _dim> vector3d_type;
+    typedef repulsion_domain<_coord_type, _dim> domain_type;
+
+    virtual ~repulsion_backend(void) = default;
+    virtual const char *name(void) const = 0;
+    virtual const char *complexity_name(void) const = 0;
+    virtual double complexity(double n) const = 0;
+    virtual void build(domain_type &d) const = 0;
+    virtual vector3d_type force(const domain_type &d, const vertex_type *v) const = 0;
+    virtual void release(domain_type &) const {}
+};
+
+
+// 
+// Sum of repulsion forces exerted on a vertex at x with mass factor f by the n
+// points of a batch (c[k] being the k-th axis, m the masses) into F, see
+// vec_batch.hh for the dispatch. Points closer than 1 / sqrt(reps2) are skipped,
+// the number of them is returned
+// 
+template <typename _force_model, typename T, int _dim>
+VEC_BATCH_KERNEL int batch_repulsion(
+    const T *const *c, const T *m, size_t n, const T *x, T f, T reps2, T *F)
+{
+    T fx = 0, fy = 0, fz = 0;
+    int n_close = 0;
+#pragma omp simd reduction(+: fx, fy, fz, n_close)
+    for (size_t i = 0; i < n; i++) {
+        T dx = x[0] - c[0][i];
+        T dy = x[1] - c[1][i];
+        T dz = (_dim == 3)? x[2] - c[_dim - 1][i]: 0;
+        T dd = dx * dx + dy * dy + dz * dz;
+        bool close = (dd * reps2 < 1);
+        T rdd = 1 / sqrt(close? 1: dd);
+        T fac = close? 0: _force_model::repulsion(f * m[i], rdd);
+        fx += fac * dx;
+        fy += fac * dy;
+        fz += fac * dz;
+        n_close += close;
+    }
+    F[0] = fx;
+    F[1] = fy;
+    F[2] = fz;
+    return n_close;
+}
+
+
+// 
+// Sum up repulsion forces exerted on v by every other vertex in the domain. The
+// positions and masses of the domain are copied into a vector batch when the domain
+// is built, so that the sum is computed by batch_repulsion. Vertices too close to v
+// (including v itself) are skipped by the kernel and handled afterwards
+// 
+template <typename _coord_type, int _dim = 3,
+          typename _force_model = spring_electrical>
+class repulsion_brute_force : public repulsion_backend<_coord_type, _dim>
+{
+public:
+    typedef repulsion_backend<_coord_type, _dim> base_type;
+    typedef typename base_type::vertex_type vertex_type;
+    typedef typename base_type::vector3d_type vector3d_type;
+    typedef typename base_type::domain_type domain_type;
+
+    virtual const char *name(void) const { return "brute-force"; }
+    virtual const char *complexity_name(void) const { return "n^2"; }
+    virtual double complexity(double n) const { return n * n; }
+
+    virtual void build(domain_type &d) const
+    {
+        size_t n = d.end - d.begin;
+        state_type *s = new state_type();
+        s->x.resize(n);
+        s->mass.resize(n);
+        for (size_t i = 0; i < n; i++) {
+            s->x.set(i, d.begin[i]->x);
+            s->mass[i] = _force_model::mass(d.begin[i]);
+        }
+        d.state = s;
+    }
+
+    virtual vector3d_type force(const domain_type &d, const vertex_type *v) const
+    {
+        auto s = static_cast<const state_type *>(d.state);
+        size_t n = s->x.size();
+        _coord_type reps = 2 / sqrt(d.eps), reps2 = reps * reps;
+        _coord_type f = d.f0 * _force_model::mass(v);
+        _coord_type x[3];
+        v->x.coord(x[0], x[1], x[2]);
+        const _coord_type *c[3] = { s->x[0], s->x[1], s->x[_dim - 1] };
+        _coord_type F[3];
+        int n_close = batch_repulsion<_force_model, _coord_type, _dim>(
+            c, s->mass.data(), n, x, f, reps2, F);
+        vector3d_type F_r(F[0], F[1], F[2]);
+
+        // vertices (almost) coinciding with v push it in random directions
+        if (n_close > 1) {
+            for (auto p = d.begin; p != d.end; ++p) {
+                const vertex_type *v2 = *p;
+                if (v != v2 and (v->x - v2->x).rmod() > reps) {
+                    F_r += vector3d_type(
+                        rand_range(-reps, reps),
+                        rand_range(-reps, reps),
+                        rand_range(-reps, reps));
+                }
+            }
+        }
+        return F_r;
+    }
+
+    virtual void release(domain_type &d) const
+    {
+        delete static_cast<state_type *>(d.state);
+        d.state = nullptr;
+    }
+
+private:
+    struct state_type {
+        vector_batch<_coord_type, _dim> x;
+        std::vector<_coord_type> mass;
+    };
+};
+
+
+// 
+// Barnes-Hut approximation of repulsion forces with a spatial octree
+// 
+template <typename _coord_type, int _dim = 3,
+          typename _force_model = spring_electrical>
+class repulsion_octree : public repulsion_backend<_coord_type, _dim>
+{
+public:
+    typedef repulsion_backend<_coord_type, _dim> base_type;
+    typedef typename base_type::vertex_type vertex_type;
+    typedef typename base_type::vector3d_type vector3d_type;
+    typedef typename base_type::domain_type domain_type;
+    typedef spatial_octree<_coord_type, _dim, _force_model> octree_type;
+
+    virtual const char *name(void) const { return "octree"; }
+    virtual const char *complexity_name(void) const { return "n log n"; }
+    virtual double complexity(double n) const { return n * log2(n + 1); }
+
+    virtual void build(domain_type &d) const
+    {
+        octree_type *t = octree_type::alloc(
+            nullptr,
+            d.x_min - 10, d.x_max + 10,
+            d.y_min - 10, d.y_max + 10,
+            d.z_min - 10, d.z_max + 10);
+        for (auto p = d.begin; p != d.end; ++p) t->insert(*p);
+        d.state = t;
+    }
+
+    virtual vector3d_type force(const domain_type &d, const vertex_type *v) const
+    {
+        auto t = static_cast<const octree_type *>(d.state);
+        return t->repulsion_force(v, d.f0, 1 / sqrt(d.eps));
+    }
+
+    virtual void release(domain_type &d) const
+    {
+        static_cast<octree_type *>(d.state)->recycle();
+        d.state = nullptr;
+    }
+};
+
+
+// 
+// Registry of repulsion backends. Each backend is given a cost coefficient which
+// is measured by running it on synthetic domains of a few sizes, the backend with
+// the lowest estimated cost is selected for each domain during layout. Until
+// calibrated, the coefficients reproduce REPULSION_OCTREE_THRESHOLD.
+// 
+template <typename _coord_type, int _dim = 3,
+          typename _force_model = spring_electrical>
+class repulsion_registry
+{
+public:
+    typedef repulsion_backend<_coord_type, _dim> backend_type;
+    typedef repulsion_domain<_coord_type, _dim> domain_type;
+    typedef vertex<_coord_type, _dim> vertex_type;
+
+    repulsion_registry(void) {
+        add(new repulsion_brute_force<_coord_type, _dim, _force_model>(), 1.0);
+#ifndef REPULSION_BRUTE_FORCE
+        double n = REPULSION_OCTREE_THRESHOLD;
+        add(new repulsion_octree<_coord_type, _dim, _force_model>(), n / log2(n + 1));
+#endif
+    }
+    repulsion_registry(const repulsion_registry &) = delete;
+
+    // registry shared by layers with the same coordinate type and force model that
+    // don't belong to a graph, each graph has a registry of its own
+    static repulsion_registry &instance(void) {
+        static repulsion_registry registry;
+        return registry;
+    }
+
+    // register a backend, the registry takes the ownership of it
+    int add(backend_type *b, double coef = 1.0) {
+        backends.push_back(entry_type { std::unique_ptr<backend_type>(b), coef });
+        return (int) backends.size() - 1;
+    }
+
+    size_t size(void) const { return backends.size(); }
+    const backend_type *backend(int k) const { return backends[k].b.get(); }
+
+    // cost coefficient of backend k
+    double coefficient(int k) const { return backends[k].coef; }
+
+    // take the coefficients of the backends of r with the same names, e.g. to
+    // select backends for domains of proxies with a calibrated registry
+    template <typename _registry_type>
+    void copy_coefficients(const _registry_type &r)
+    {
+        for (size_t k = 0; k < backends.size(); k++) {
+            for (size_t kr = 0; kr < r.size(); kr++) {
+                if (!strcmp(backends[k].b->name(), r.backend(kr)->name()))
+                    backends[k].coef = r.coefficient(kr);
+            }
+        }
+    }
+
+    // index of the cheapest backend for a domain of n vertices
+    int select(size_t n) const
+    {
+        int best = 0;
+        double best_cost = backends[0].coef * backends[0].b->complexity(n);
+        for (size_t k = 1; k < backends.size(); k++) {
+            double cost = backends[k].coef * backends[k].b->complexity(n);
+            if (cost < best_cost) {
+                best = (int) k;
+                best_cost = cost;
+            }
+        }
+        return best;
+    }
+
+    // calibrate once, the first layer doing layout pays for it
+    void ensure_calibrated(void) {
+        if (auto_calibrate) std::call_once(calibrated, [this]() { calibrate(); });
+    }
+
+    // 
+    // Time every backend on random domains of a few sizes and fit the coefficient
+    // of its cost model with least squares. Timing includes the OpenMP parallel
+    // force loop, so the result accounts for the number of threads. This must not
+    // run concurrently with layout.
+    // 
+    void calibrate(void)
+    {
+        const size_t sizes[] = { 256, 1024, 4096 };
+        std::vector<vertex_type *> vs;
+        for (auto &entry : backends) {
+            double sum_tg = 0, sum_gg = 0;
+            for (size_t n : sizes) {
+                _coord_type r = 10 * cbrt((double) n);
+                while (vs.size() < n) {
+                    vs.push_back(new vertex_type(
+                            rand_range(-r, r), rand_range(-r, r), rand_range(-r, r)));
+                }
+                domain_type d;
+                d.begin = vs.data();
+                d.end = vs.data() + n;
+                d.x_min = d.y_min = d.z_min = -r;
+                d.x_max = d.y_max = d.z_max = r;
+                d.f0 = 250;
+                d.eps = 0.001;
+                d.state = nullptr;
+
+                double t = 1e30;
+                for (int k = 0; k < 3; k++) {
+                    t = std::min(t, time_domain(entry.b.get(), d));
+                }
+                double g = entry.b->complexity(n);
+                sum_tg += t * g;
+                sum_gg += g * g;
+            }
+            entry.coef = sum_tg / sum_gg;
+        }
+        for (auto v : vs) delete v;
+    }
+
+    // describe the cost models and crossover points of registered backends
+    std::string report(void) const
+    {
+        std::string s;
+        char buf[256];
+        for (auto &entry : backends) {
+            snprintf(buf, sizeof(buf), "%s: cost %.3g * %s\n",
+                entry.b->name(), entry.coef, entry.b->complexity_name());
+            s += buf;
+        }
+        int k = select(1);
+        for (size_t n = 2; n <= (1 << 24); n *= 2) {
+            int kk = select(n);
+            if (kk != k) {
+                snprintf(buf, sizeof(buf), "%s -> %s at n ~ %lu\n",
+                    backends[k].b->name(), backends[kk].b->name(), n);
+                s += buf;
+                k = kk;
+            }
+        }
+        return s;
+    }
+
+    bool auto_calibrate = true;
+
+private:
+    double time_domain(const backend_type *b, domain_type &d)
+    {
+        typedef std::chrono::steady_clock clock_type;
+        auto start = clock_type::now();
+        b->build(d);
+        size_t n = d.end - d.begin;
+        double sink = 0;
+#pragma omp parallel for reduction(+: sink)
+        for (size_t i = 0; i < n; i++) {
+            sink += b->force(d, d.begin[i]).mod();
+        }
+        b->release(d);
+        auto elapsed = clock_type::now() - start;
+        (void) sink;
+        return std::chrono::duration<double>(elapsed).count();
+    }
+
+    struct entry_type {
+        std::unique_ptr<backend_type> b;
+        double coef;
+    };
+    std::vector<entry_type> backends;
+    std::once_flag calibrated;
+};
+
+
+#endif /* _REPULSION_H_ */
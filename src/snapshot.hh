@@ -0,0 +1,281 @@
+#ifndef _SNAPSHOT_H_
+#define _SNAPSHOT_H_
+
+
+#include "graph.hh"
+#include <cstdint>
+#include <functional>
+#include <unordered_map>
+#include <vector>
+
+
+// 
+// Keeps a graph in sync with full snapshots of a vertex/edge set keyed by external
+// ids, for feeds that send the whole current graph instead of deltas. Each update
+// diffs the snapshot against the previous one and applies only the changes to the
+// graph as one batch, so vertices which stay in the graph keep their positions and
+// velocities.
+// 
+// The diff is a partitioned hash join: vertices and edges of the graph are kept in
+// n_partitions hash tables by the hash of their keys, records of a snapshot are
+// scattered into the same partitions, and each partition is joined on its own (in
+// parallel). Records found in a table are stamped with the epoch of the update, the
+// ones left unstamped afterwards are gone from the snapshot.
+// 
+// Vertices and edges added by an update are owned by this object, they must not be
+// removed from the graph by other means. Edges are directed and unique per pair of
+// vertices, their strength is updated by replacing the edge
+// 
+template <typename _coord_type, int _dim = 3,
+          typename _force_model = spring_electrical>
+class snapshot_sync
+{
+public:
+    typedef graph<_coord_type, _dim, _force_model> graph_type;
+    typedef vertex<_coord_type, _dim> vertex_type;
+    typedef edge<_coord_type, _dim> edge_type;
+    typedef vector3d<_coord_type, _dim> vector3d_type;
+    typedef uint64_t key_type;
+
+    struct edge_rec {
+        key_type a, b;
+        _coord_type strength;
+    };
+
+    // numbers of changes applied by an update
+    struct delta {
+        size_t vertices_added = 0;
+        size_t vertices_removed = 0;
+        size_t edges_added = 0;
+        size_t edges_removed = 0;
+    };
+
+    snapshot_sync(graph_type *g, int n_partitions = 64)
+        : g(g), vertex_parts(n_partitions), edge_parts(n_partitions) {
+    }
+    snapshot_sync(const snapshot_sync &) = delete;
+
+    // 
+    // Bring the graph to the given snapshot. Duplicate vertices and edges are
+    // ignored, so are edges with an end missing from the snapshot
+    // 
+    delta update(const std::vector<key_type> &keys, const std::vector<edge_rec> &es);
+
+    // vertex of key k, or nullptr
+    vertex_type *find(key_type k) const
+    {
+        auto &part = vertex_parts[partition(k)];
+        auto p = part.find(k);
+        return (p != part.end())? p->second.v: nullptr;
+    }
+
+    // create the vertex of a new key, its position is set by update()
+    std::function<vertex_type *(key_type)> make_vertex = [](key_type) {
+        return new vertex_styled<_coord_type, _dim>(vector3d_type::zero);
+    };
+
+    // create the edge of a new record
+    std::function<edge_type *(vertex_type *, vertex_type *, const edge_rec &)>
+        make_edge = [](vertex_type *a, vertex_type *b, const edge_rec &r) {
+            edge_type *e = new edge_styled<_coord_type, _dim>(a, b);
+            e->strength = r.strength;
+            return e;
+        };
+
+    // new vertices without an old neighbour are placed at random in a cube of this
+    // size, the others next to their neighbour
+    _coord_type spread = 10;
+
+protected:
+    struct vertex_entry {
+        vertex_type *v;
+        unsigned epoch;
+    };
+    struct edge_entry {
+        edge_type *e;
+        _coord_type strength;
+        unsigned epoch;
+    };
+    struct edge_key {
+        key_type a, b;
+        bool operator==(const edge_key &k) const { return a == k.a and b == k.b; }
+    };
+    struct key_hash {
+        size_t operator()(key_type k) const { return mix(k); }
+        size_t operator()(const edge_key &k) const {
+            return mix(k.a ^ (mix(k.b) + 0x9e3779b97f4a7c15ULL));
+        }
+    };
+
+    static uint64_t mix(uint64_t h) {
+        h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+        return h ^ (h >> 31);
+    }
+    // partitions take the high bits of the hash, tables within them the low bits
+    size_t partition(key_type k) const {
+        return (key_hash()(k) >> 40) % vertex_parts.size();
+    }
+    size_t partition(const edge_key &k) const {
+        return (key_hash()(k) >> 40) % edge_parts.size();
+    }
+
+    // scatter indices of records into partitions of their keys
+    template <typename _key_of_type>
+    std::vector<std::vector<size_t>> scatter(
+        size_t n, size_t n_parts, _key_of_type key_of) const
+    {
+        std::vector<std::vector<size_t>> parts(n_parts);
+        for (size_t i = 0; i < n; i++) parts[partition(key_of(i))].push_back(i);
+        return parts;
+    }
+
+    graph_type *g;
+    unsigned epoch = 0;
+    std::vector<std::unordered_map<key_type, vertex_entry, key_hash>> vertex_parts;
+    std::vector<std::unordered_map<edge_key, edge_entry, key_hash>> edge_parts;
+};
+
+
+template <typename _coord_type, int _dim, typename _force_model>
+typename snapshot_sync<_coord_type, _dim, _force_model>::delta
+snapshot_sync<_coord_type, _dim, _force_model>::update(
+    const std::vector<key_type> &keys, const std::vector<edge_rec> &es)
+{
+    epoch += 1;
+    long n_vparts = vertex_parts.size(), n_eparts = edge_parts.size();
+
+    // join vertices of the snapshot with the vertices of the graph
+    auto vscatter = scatter(keys.size(), n_vparts,
+        [&](size_t i) { return keys[i]; });
+    std::vector<std::vector<key_type>> vadded(n_vparts);
+    std::vector<std::vector<vertex_type *>> vremoved(n_vparts);
+#pragma omp parallel for schedule(dynamic, 1)
+    for (long p = 0; p < n_vparts; p++) {
+        auto &part = vertex_parts[p];
+        for (size_t i : vscatter[p]) {
+            auto q = part.find(keys[i]);
+            if (q == part.end()) {
+                part.insert({ keys[i], vertex_entry { nullptr, epoch } });
+                vadded[p].push_back(keys[i]);
+            }
+            else {
+                q->second.epoch = epoch;
+            }
+        }
+        for (auto q = part.begin(); q != part.end(); ) {
+            if (q->second.epoch != epoch) {
+                vremoved[p].push_back(q->second.v);
+                q = part.erase(q);
+            }
+            else {
+                ++q;
+            }
+        }
+    }
+
+    // vertices are created serially, as vertex ids are taken from a plain counter
+    std::vector<vertex_type *> new_vs;
+    for (long p = 0; p < n_vparts; p++) {
+        for (key_type k : vadded[p]) {
+            vertex_type *v = make_vertex(k);
+            vertex_parts[p][k].v = v;
+            new_vs.push_back(v);
+        }
+    }
+
+    // join edges of the snapshot with the edges of the graph, by then the vertex
+    // tables are only read
+    auto escatter = scatter(es.size(), n_eparts,
+        [&](size_t i) { return edge_key { es[i].a, es[i].b }; });
+    std::vector<std::vector<size_t>> eadded(n_eparts);
+    std::vector<std::vector<edge_type *>> eremoved(n_eparts);
+#pragma omp parallel for schedule(dynamic, 1)
+    for (long p = 0; p < n_eparts; p++) {
+        auto &part = edge_parts[p];
+        for (size_t i : escatter[p]) {
+            const edge_rec &r = es[i];
+            if (!find(r.a) or !find(r.b)) continue;
+            auto q = part.find(edge_key { r.a, r.b });
+            if (q == part.end()) {
+                part.insert({ edge_key { r.a, r.b }, edge_entry { nullptr, 0, epoch } });
+                eadded[p].push_back(i);
+            }
+            else if (q->second.epoch != epoch) {
+                q->second.epoch = epoch;
+                if (q->second.strength != r.strength) {
+                    eremoved[p].push_back(q->second.e);
+                    eadded[p].push_back(i);
+                }
+            }
+        }
+        for (auto q = part.begin(); q != part.end(); ) {
+            if (q->second.epoch != epoch) {
+                eremoved[p].push_back(q->second.e);
+                q = part.erase(q);
+            }
+            else {
+                ++q;
+            }
+        }
+    }
+
+    // place new vertices next to an old neighbour, or next to a new neighbour that
+    // is placed already
+    std::unordered_map<vertex_type *, bool> placed;
+    for (auto v : new_vs) placed[v] = false;
+    for (int pass = 0; pass < 2; pass++) {
+        for (long p = 0; p < n_eparts; p++) {
+            for (size_t i : eadded[p]) {
+                vertex_type *a = find(es[i].a), *b = find(es[i].b);
+                auto pa = placed.find(a), pb = placed.find(b);
+                bool a_fixed = (pa == placed.end() or pa->second);
+                bool b_fixed = (pb == placed.end() or pb->second);
+                if (a_fixed == b_fixed) continue;
+                vertex_type *from = a_fixed? a: b, *to = a_fixed? b: a;
+                _coord_type r = 1;
+                to->x = from->x + vector3d_type(
+                    rand_range(-r, r), rand_range(-r, r), rand_range(-r, r));
+                placed[to] = true;
+            }
+        }
+    }
+    for (auto v : new_vs) {
+        if (placed[v]) continue;
+        _coord_type r = spread / 2;
+        v->x = vector3d_type(rand_range(-r, r), rand_range(-r, r), rand_range(-r, r));
+    }
+
+    // apply the changes as one batch: edges go before the vertices they leave
+    typename graph_type::batch b;
+    delta d;
+    for (auto &part : eremoved) {
+        for (auto e : part) b.remove_edge(e);
+        d.edges_removed += part.size();
+    }
+    for (auto &part : vremoved) {
+        for (auto v : part) b.remove_vertex(v);
+        d.vertices_removed += part.size();
+    }
+    for (auto v : new_vs) b.add_vertex(v);
+    d.vertices_added = new_vs.size();
+    for (long p = 0; p < n_eparts; p++) {
+        for (size_t i : eadded[p]) {
+            const edge_rec &r = es[i];
+            edge_type *e = make_edge(find(r.a), find(r.b), r);
+            edge_entry &entry = edge_parts[p][edge_key { r.a, r.b }];
+            entry.e = e;
+            entry.strength = r.strength;
+            b.add_edge(e);
+        }
+        d.edges_added += eadded[p].size();
+    }
+    g->apply(b);
+    for (auto &part : vremoved) {
+        for (auto v : part) delete v;
+    }
+    return d;
+}
+
+
+#endif /* _SNAPSHOT_H_ */
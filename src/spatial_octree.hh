@@ -1,17 +1,25 @@
 #ifndef _SPATIAL_OCTREE_H_
 #define _SPATIAL_OCTREE_H_
 
-#include "vertex_edge.hh"
+#include "force_model.hh"
 #include <string.h>
 
 
-template <typename _coord_type>
+// 
+// Octree partitioning of the space for approximating repulsion forces (Barnes-Hut).
+// Each cell keeps the total mass and the mass-weighted centroid of its vertices,
+// masses are given by the force model. For 2D layouts the cells are only divided
+// along x and y, which makes this a quadtree
+// 
+template <typename _coord_type, int _dim = 3,
+          typename _force_model = spring_electrical>
 class spatial_octree
 {
 public:
-    typedef vertex<_coord_type>    vertex_type;
-    typedef vector3d<_coord_type>  vector3d_type;
+    typedef vertex<_coord_type, _dim>    vertex_type;
+    typedef vector3d<_coord_type, _dim>  vector3d_type;
     typedef _coord_type            float_type;
+    static const int n_subspaces = 1 << _dim;
 
     spatial_octree(
         vertex_type *v,
@@ -19,7 +27,7 @@ public:
         float_type y_min, float_type y_max,
         float_type z_min, float_type z_max)
         : v(v),
-          n_vertices(0),
+          mass(0),
           c(0, 0, 0),
           x(0.5 * (x_min + x_max)),
           y(0.5 * (y_min + y_max)),
@@ -30,8 +38,8 @@ public:
     {
         memset(subspaces, 0, sizeof(subspaces));
         if (v) {
-            n_vertices = 1;
-            c = v->x;
+            mass = _force_model::mass(v);
+            c = mass * v->x;
         }
     }
 
@@ -52,11 +60,11 @@ public:
         this->z = 0.5 * (z_min + z_max);
         memset(subspaces, 0, sizeof(subspaces));
         if (v) {
-            n_vertices = 1;
-            c = v->x;
+            mass = _force_model::mass(v);
+            c = mass * v->x;
         }
         else {
-            n_vertices = 0;
+            mass = 0;
             c = vector3d_type::zero;
         }
     }
@@ -64,7 +72,7 @@ public:
     ~spatial_octree(void) = delete;
 
     void recycle(void) {
-        for (int i = 0; i < 8; i++) {
+        for (int i = 0; i < n_subspaces; i++) {
             if (subspaces[i]) subspaces[i]->recycle();
         }
         dealloc(this);
@@ -86,7 +94,8 @@ public:
         int lx = (vx >= x and vx <= x_max);
         int ly = (vy >= y and vy <= y_max);
         int lz = (vz >= z and vz <= z_max);
-        int i_subspace = ((lx << 2) | (ly << 1) | lz);
+        int i_subspace = (_dim == 3)?
+            ((lx << 2) | (ly << 1) | lz): ((lx << 1) | ly);
 
         spatial_octree *subspace = subspaces[i_subspace];
         if (subspace == nullptr) {
@@ -102,25 +111,27 @@ public:
             subspaces[i_subspace] = alloc(
                 v, v_xmin, v_xmax, v_ymin, v_ymax, v_zmin, v_zmax);
 
-            n_vertices += 1;
-            c += v->x;
+            float_type m = _force_model::mass(v);
+            mass += m;
+            c += m * v->x;
         }
         else if (subspace->v == nullptr) {
             // this subspace is subdivided into sub-subspaces, insert this vertex
             // into appropriate sub-subspace
             subspace->insert(v);
-            n_vertices += 1;
-            c += v->x;
+            float_type m = _force_model::mass(v);
+            mass += m;
+            c += m * v->x;
         }
         else {
-            // subspace already containing a vertex, split this subspace into 8
+            // subspace already containing a vertex, split this subspace into 2^dim
             // smaller sub-subspaces, lower subspace->v one level down, and try
             // inserting v again
             vertex_type *vv = subspace->v;
             if ((v->x - vv->x).mod() < 1e-6) return;
 
             subspace->v = nullptr;
-            subspace->n_vertices = 0;
+            subspace->mass = 0;
             subspace->c = vector3d_type::zero;
             subspace->insert(vv);
             subspace->insert(v);
@@ -129,7 +140,7 @@ public:
 
     vector3d_type centroid(void) const {
         if (v) return v->x;
-        else return _coord_type(1.0 / n_vertices) * c;
+        else return _coord_type(1.0 / mass) * c;
     }
 
 
@@ -143,20 +154,20 @@ public:
         float_type l = vector3d_type(
             x_max - x_min, y_max - y_min, z_max - z_min).rmod();
         if (v or rdd < l) {
-            auto denom = rdd;
-            auto fac = f0 * (denom * denom * denom);
+            auto fac = _force_model::repulsion(
+                f0 * _force_model::mass(v2) * mass, rdd);
             if (rdd > 2 * reps) {
-                fac = 1;
+                fac = mass;
                 dx = vector3d_type(
                     rand_range(-reps, reps),
                     rand_range(-reps, reps),
                     rand_range(-reps, reps));
             }
-            return (n_vertices * fac) * dx;
+            return fac * dx;
         }
         else {
             vector3d_type F_r = vector3d_type::zero;
-            for (int i = 0; i < 8; i++) {
+            for (int i = 0; i < n_subspaces; i++) {
                 if (subspaces[i]) 
                     F_r += subspaces[i]->repulsion_force(
                         v2, f0, reps);
@@ -166,9 +177,10 @@ public:
     }
 
     // 
-    // object pool for faster allocation/deallocation
+    // object pool for faster allocation/deallocation, the pool is kept per thread
+    // so that octrees of different components can be built concurrently
     // 
-    static std::vector<spatial_octree<_coord_type> *> objpool;
+    static thread_local std::vector<spatial_octree *> objpool;
 
     static spatial_octree *alloc(
         vertex_type *v,
@@ -183,30 +195,35 @@ public:
             return obj;
         }
         else {
-            return new spatial_octree<_coord_type>(v, 
+            return new spatial_octree(v, 
                 x_min, x_max,
                 y_min, y_max,
                 z_min, z_max);
         }
     }
 
-    static void dealloc(spatial_octree<_coord_type> *t) {
+    static void dealloc(spatial_octree *t) {
         objpool.push_back(t);
     }
 
 
     vertex_type *v;
-    int n_vertices;
+    float_type mass;
     vector3d_type c;
     float_type x, y, z;
     float_type x_min, x_max, y_min, y_max, z_min, z_max;
-    spatial_octree *subspaces[8];
+    spatial_octree *subspaces[n_subspaces];
 };
 
 
-template <typename _coord_type>
-std::vector<spatial_octree<_coord_type> *> spatial_octree<_coord_type>::objpool;
+template <typename _coord_type, int _dim, typename _force_model>
+thread_local std::vector<spatial_octree<_coord_type, _dim, _force_model> *>
+spatial_octree<_coord_type, _dim, _force_model>::objpool;
 
 
 
+template <typename _coord_type, typename _force_model = spring_electrical>
+using spatial_quadtree = spatial_octree<_coord_type, 2, _force_model>;
+
+
 #endif /* _SPATIAL_OCTREE_H_ */
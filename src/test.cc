@@ -1,6 +1,12 @@
 #include "galaster.hh"
+#include "distributed.hh"
+#include "mapped_graph.hh"
+#include "snapshot.hh"
 #include "verify.hh"
 #include <iostream>
+#include <map>
+#include <set>
+#include <string>
 #include <unistd.h>
 
 typedef double _float_type;
@@ -150,6 +156,597 @@ void random_test(int n_layers, int n_vertex, int epochs)
     delete graph;
 }
 
+// 
+// Build the layers of a random graph with add_bulk, mutate it in batches and
+// re-optimize its coarser layers. The hierarchy must stay consistent throughout
+// 
+void bulk_test(int n_layers, int n_vertex, int epochs)
+{
+    graph_type *graph = new graph_type(n_layers, 
+        250,                    // f0
+        0.02,                   // K
+        0.001,                  // eps
+        0.6,                    // damping
+        1.2);                   // dilation
+
+    auto check = [&](const char *stage) {
+        if (!verify_integrity(graph)) {
+            printf("!!! INTEGRITY CHECK FAILED (%s) !!!\n", stage);
+            exit(-1);
+        }
+        if (!verify_redundancy(graph)) {
+            printf("!!! REDUNDANCY CHECK FAILED (%s) !!!\n", stage);
+            exit(-1);
+        }
+        if (!verify_matching(graph)) {
+            printf("!!! MATCHING CHECK FAILED (%s) !!!\n", stage);
+            exit(-1);
+        }
+    };
+
+    std::vector<vertex_type *> vs;
+    std::vector<edge_type *> es;
+    for (int k = 0; k < n_vertex; k++) {
+        vs.push_back(new vertex_styled<_float_type>(
+                randint(-100, 100),
+                randint(-100, 100),
+                randint(-100, 100)));
+        if (k > 0) es.push_back(
+            new edge_styled<_float_type>(vs[randint(0, k - 1)], vs[k]));
+    }
+    for (int k = 0; k < n_vertex; k++) {
+        es.push_back(new edge_styled<_float_type>(
+                vs[randint(0, n_vertex - 1)], vs[randint(0, n_vertex - 1)]));
+    }
+    graph->add_bulk(vs, es);
+    check("add_bulk");
+
+    for (int k = 0; k < epochs; k++) {
+        graph_type::batch b;
+        std::set<edge_type *> removed;
+        for (int i = 0; i < n_vertex / 10; i++) {
+            vertex_type *a = vs[randint(0, n_vertex - 1)];
+            if (randint(0, 1) and !a->es.empty()) {
+                edge_type *e = a->es[randint(0, a->es.size() - 1)];
+                if (removed.insert(e).second) b.remove_edge(e);
+            }
+            else {
+                vertex_type *c = vs[randint(0, n_vertex - 1)];
+                b.add_edge(new edge_styled<_float_type>(a, c));
+            }
+        }
+        graph->apply(b);
+        check("batch");
+    }
+
+    // a negative tolerance takes the finest layer as degraded, so that all of the
+    // coarser layers are rebuilt by the next layout
+    if (!graph->reoptimize(-1)) {
+        printf("!!! REOPTIMIZE CHECK FAILED !!!\n");
+        exit(-1);
+    }
+    for (int k = 0; k < 10; k++) graph->layout(1.0);
+    check("reoptimize");
+    printf("bulk test passed\n");
+
+    delete graph;
+}
+
+// 
+// Lay out a chain of spline edges with the focus on one vertex: the centroid of the
+// edge entering the focus from a frozen vertex has to be collected with its end b
+// 
+void focus_spline_test(int n_layers, int n_vertex)
+{
+    graph_type *graph = new graph_type(n_layers, 
+        250,                    // f0
+        0.02,                   // K
+        0.001,                  // eps
+        0.6,                    // damping
+        1.2);                   // dilation
+
+    std::vector<vertex_type *> vs;
+    for (int k = 0; k < n_vertex; k++) {
+        auto v = new vertex_styled<_float_type>(
+            randint(-100, 100),
+            randint(-100, 100),
+            randint(-100, 100));
+        graph->add_vertex(v);
+        vs.push_back(v);
+    }
+    for (int k = 0; k < n_vertex - 1; k++) {
+        auto e = new edge_styled<_float_type>(vs[k], vs[k + 1]);
+        e->spline = true;
+        graph->add_edge(e);
+    }
+
+    graph->set_focus({vs[n_vertex / 2]}, 0);
+    for (int k = 0; k < 100; k++) graph->layout(1.0);
+    graph->clear_focus();
+    for (int k = 0; k < 100; k++) graph->layout(1.0);
+
+    // two isolated vertices in the region of interest repel each other
+    auto a = new vertex_styled<_float_type>(0, 0, 0);
+    auto b = new vertex_styled<_float_type>(1, 0, 0);
+    graph->add_vertex(a);
+    graph->add_vertex(b);
+    graph->set_focus({a, b}, 0);
+    double d0 = (a->x - b->x).mod();
+    for (int k = 0; k < 50; k++) graph->layout(1.0);
+    double d1 = (a->x - b->x).mod();
+    graph->clear_focus();
+    if (!(d1 > d0)) {
+        printf("!!! FOCUSED REPULSION CHECK FAILED !!!\n");
+        printf("distance %lf -> %lf\n", d0, d1);
+        exit(-1);
+    }
+    printf("focus spline test passed\n");
+
+    delete graph;
+}
+
+// 
+// Compare the batch kernels with scalar code, on lengths which aren't multiples of
+// any vector width so that the remainder loops are covered too
+// 
+void batch_kernel_test(size_t n)
+{
+    std::vector<_float_type> x(n), delta(n), u(n), w(n), dx(n), ddx(n), acc(n);
+    for (size_t i = 0; i < n; i++) {
+        x[i] = rand_range(-100, 100);
+        u[i] = rand_range(-5, 5);
+        w[i] = rand_range(-5, 5);
+        dx[i] = rand_range(-5, 5);
+        ddx[i] = rand_range(-5, 5);
+        acc[i] = rand_range(-5, 5);
+    }
+    std::vector<_float_type> x0 = x, dx0 = dx, ddx0 = ddx;
+    _float_type lo, hi;
+    batch_bounds(x.data(), n, lo, hi);
+    batch_bounded_add(x.data(), delta.data(), u.data(), w.data(),
+        _float_type(0.5), _float_type(0.25), _float_type(3), n);
+    batch_verlet(dx.data(), ddx.data(), acc.data(),
+        _float_type(0.5), _float_type(0.9), n);
+
+    _float_type lo0 = x0[0], hi0 = x0[0];
+    for (size_t i = 0; i < n; i++) {
+        lo0 = std::min(lo0, x0[i]);
+        hi0 = std::max(hi0, x0[i]);
+        _float_type d = std::max(std::min(0.5 * u[i] + 0.25 * w[i], 3.0), -3.0);
+        _float_type v = 0.9 * (dx0[i] + 0.5 * (ddx0[i] + acc[i]));
+        if (fabs(delta[i] - d) > 1e-4 or fabs(x[i] - (x0[i] + d)) > 1e-4 or
+            fabs(dx[i] - v) > 1e-4 or ddx[i] != acc[i]) {
+            printf("!!! BATCH KERNEL CHECK FAILED !!!\n");
+            printf("element %lu of %lu\n", (unsigned long) i, (unsigned long) n);
+            exit(-1);
+        }
+    }
+    if (lo != lo0 or hi != hi0) {
+        printf("!!! BATCH BOUNDS CHECK FAILED !!!\n");
+        exit(-1);
+    }
+    printf("batch kernel test passed (%lu)\n", (unsigned long) n);
+}
+
+// 
+// Schedule elements on a timer wheel at ticks of every level, each has to expire
+// exactly at its tick after cascading down, cancelled ones never. A wheel idle since
+// tick 0 has to jump to the current tick instead of stepping through the gap. Then
+// vertices and edges with a time to live have to be removed from a graph
+// 
+void timer_wheel_test(void)
+{
+    struct item {
+        timer_link<item> link;
+        uint64_t due;
+    };
+    const uint64_t dues[] = { 1, 2, 63, 64, 65, 100, 4095, 4096, 4097, 5000,
+        262143, 262144, 300000, 20000000 };
+    const int n_items = sizeof(dues) / sizeof(dues[0]);
+    timer_wheel<item> wheel;
+    std::vector<item> items(n_items + 1);
+    for (int i = 0; i <= n_items; i++) {
+        items[i].link.owner = &items[i];
+        items[i].due = (i < n_items)? dues[i]: 1000;
+        wheel.schedule(&items[i].link, items[i].due, 0);
+    }
+    items[n_items].link.unlink();
+
+    std::vector<item *> expired;
+    for (int i = 0; i < n_items; i++) {
+        wheel.advance(dues[i] - 1, expired);
+        bool early = !expired.empty();
+        wheel.advance(dues[i], expired);
+        if (early or expired.size() != 1 or expired[0] != &items[i]) {
+            printf("!!! TIMER WHEEL CASCADE CHECK FAILED (tick %lu) !!!\n",
+                (unsigned long) dues[i]);
+            exit(-1);
+        }
+        expired.clear();
+    }
+    if (!wheel.empty()) {
+        printf("!!! TIMER WHEEL CANCEL CHECK FAILED !!!\n");
+        exit(-1);
+    }
+
+    uint64_t t = uint64_t(1) << 40;
+    timer_wheel<item> idle;
+    idle.schedule(&items[0].link, t + 5, t);
+    idle.advance(t + 4, expired);
+    if (idle.tick() != t + 4 or !expired.empty()) {
+        printf("!!! TIMER WHEEL IDLE CHECK FAILED !!!\n");
+        exit(-1);
+    }
+    idle.advance(t + 5, expired);
+    if (expired.size() != 1) {
+        printf("!!! TIMER WHEEL IDLE CHECK FAILED !!!\n");
+        exit(-1);
+    }
+
+    graph_type *graph = new graph_type(3, 
+        250,                    // f0
+        0.02,                   // K
+        0.001,                  // eps
+        0.6,                    // damping
+        1.2);                   // dilation
+    std::vector<vertex_type *> vs;
+    for (int k = 0; k < 20; k++) {
+        auto v = new vertex_styled<_float_type>(k, 0, 0);
+        if (k % 2) v->ttl = 0.2;
+        graph->add_vertex(v);
+        vs.push_back(v);
+    }
+    auto e = new edge_styled<_float_type>(vs[0], vs[2]);
+    e->ttl = 0.2;
+    graph->add_edge(e);
+    graph->add_edge(new edge_styled<_float_type>(vs[0], vs[4]));
+    graph->add_edge(new edge_styled<_float_type>(vs[0], vs[1]));
+    graph->layout(1.0);
+    if (graph->g->vs.size() != 20) {
+        printf("!!! EXPIRY CHECK FAILED !!!\n");
+        exit(-1);
+    }
+    usleep(400000);
+    graph->layout(1.0);
+    if (graph->g->vs.size() != 10 or vs[0]->es.size() != 1 or 
+        !verify_integrity(graph)) {
+        printf("!!! EXPIRY CHECK FAILED !!!\n");
+        exit(-1);
+    }
+    printf("timer wheel test passed\n");
+
+    delete graph;
+}
+
+// 
+// Churn key_map and string_pool against std::map, so that backward shift deletion
+// runs over long probe sequences, then bind and rebind integer and string keys of
+// vertices in a graph. Keys of removed vertices have to be unbound
+// 
+void key_index_test(int n_keys, int epochs)
+{
+    key_map<int> map;
+    std::map<uint64_t, int> map_ref;
+    string_pool pool;
+    std::map<std::string, uint32_t> pool_ref;
+    for (int k = 0; k < epochs; k++) {
+        uint64_t key = randint(0, n_keys - 1);
+        std::string str = "key" + std::to_string(key);
+        if (randint(0, 1)) {
+            *map.insert(key).first = k;
+            map_ref[key] = k;
+            pool_ref[str] = pool.intern(str);
+        }
+        else {
+            if (map.erase(key) != (map_ref.erase(key) > 0)) {
+                printf("!!! KEY MAP ERASE CHECK FAILED !!!\n");
+                exit(-1);
+            }
+            if (pool_ref.count(str)) {
+                pool.release(pool_ref[str]);
+                pool_ref.erase(str);
+            }
+        }
+    }
+    for (uint64_t key = 0; key < (uint64_t) n_keys; key++) {
+        const int *value = map.find(key);
+        auto p = map_ref.find(key);
+        if ((p == map_ref.end())? value != nullptr: (!value or *value != p->second)) {
+            printf("!!! KEY MAP FIND CHECK FAILED !!!\n");
+            exit(-1);
+        }
+        std::string str = "key" + std::to_string(key);
+        auto q = pool_ref.find(str);
+        uint32_t id = pool.find(str);
+        if ((q == pool_ref.end())? id != string_pool::none:
+            (id != q->second or pool.str(id) != str)) {
+            printf("!!! STRING POOL FIND CHECK FAILED !!!\n");
+            exit(-1);
+        }
+    }
+    if (map.size() != map_ref.size() or pool.size() != pool_ref.size()) {
+        printf("!!! KEY INDEX SIZE CHECK FAILED !!!\n");
+        exit(-1);
+    }
+
+    graph_type *graph = new graph_type(3, 
+        250,                    // f0
+        0.02,                   // K
+        0.001,                  // eps
+        0.6,                    // damping
+        1.2);                   // dilation
+    std::vector<vertex_type *> vs;
+    for (int k = 0; k < 4; k++) {
+        vs.push_back(new vertex_styled<_float_type>(k, 0, 0));
+        graph->add_vertex(vs.back());
+    }
+    const std::string a = "a", b = "b";
+    graph->set_key(vs[0], uint64_t(1));
+    graph->set_key(vs[1], a);
+    graph->set_key(vs[2], uint64_t(1));     // taken from vs[0]
+    graph->set_key(vs[3], a);               // taken from vs[1]
+    graph->set_key(vs[0], b);
+    graph->set_key(vs[0], uint64_t(2));     // b is dropped
+    bool ok = graph->find_vertex(uint64_t(1)) == vs[2] and
+        graph->find_vertex(a) == vs[3] and
+        graph->find_vertex(b) == nullptr and
+        graph->find_vertex(uint64_t(2)) == vs[0];
+    graph->remove_vertex(vs[2]);
+    graph->remove_vertex(vs[3]);
+    ok = ok and graph->find_vertex(uint64_t(1)) == nullptr and
+        graph->find_vertex(a) == nullptr;
+    graph->set_key(vs[1], a);
+    ok = ok and graph->find_vertex(a) == vs[1];
+    if (!ok) {
+        printf("!!! KEY BINDING CHECK FAILED !!!\n");
+        exit(-1);
+    }
+    delete vs[2];
+    delete vs[3];
+    printf("key index test passed\n");
+
+    delete graph;
+}
+
+// 
+// Lay out a random tree in _dim dimensions with a force model, vertices of a 2D
+// layout must stay in the plane, and the layout must settle with edges much
+// shorter than the distances between random pairs of vertices
+// 
+template <int _dim, typename _force_model>
+void model_test(const char *name, double f0, double K, int n_vertex, int iterations)
+{
+    typedef graph<_float_type, _dim, _force_model> model_graph_type;
+    typedef vertex<_float_type, _dim> model_vertex_type;
+    model_graph_type *graph = new model_graph_type(0, 
+        f0,                     // f0
+        K,                      // K
+        0.001,                  // eps
+        0.6,                    // damping
+        1.2);                   // dilation
+
+    std::vector<model_vertex_type *> vs;
+    for (int k = 0; k < n_vertex; k++) {
+        auto v = new vertex_styled<_float_type, _dim>(
+            randint(-100, 100),
+            randint(-100, 100),
+            randint(-100, 100));
+        graph->add_vertex(v);
+        vs.push_back(v);
+        if (k > 0) graph->add_edge(
+            new edge_styled<_float_type, _dim>(vs[randint(0, k - 1)], v));
+    }
+    double max_ddx = 0;
+    for (int k = 0; k < iterations; k++) max_ddx = graph->layout(1.0);
+
+    double length = 0, distance = 0;
+    bool planar = true;
+    for (int k = 0; k < n_vertex; k++) {
+        auto v = vs[k];
+        for (auto e : v->es) {
+            if (e->a == v) length += (e->a->x - e->b->x).mod();
+        }
+        distance += (v->x - vs[randint(0, n_vertex - 1)]->x).mod();
+        _float_type x, y, z;
+        v->x.coord(x, y, z);
+        planar = planar and (_dim == 3 or z == 0);
+    }
+    length /= n_vertex - 1;
+    distance /= n_vertex;
+    printf("[%s]: %lu layers, max_ddx %f, mean edge length %f, mean distance %f\n",
+        name, graph->layers.size(), max_ddx, length, distance);
+    if (!std::isfinite(max_ddx) or !std::isfinite(length) or !planar or
+        length > 0.5 * distance) {
+        printf("!!! FORCE MODEL CHECK FAILED (%s) !!!\n", name);
+        exit(-1);
+    }
+
+    delete graph;
+}
+
+// 
+// Grow and shrink a graph through full snapshots of random subsets of keys, the
+// graph must hold exactly the vertices of the last snapshot
+// 
+void snapshot_test(int n_layers, int n_vertex, int epochs)
+{
+    typedef snapshot_sync<_float_type> sync_type;
+    graph_type *graph = new graph_type(n_layers, 
+        250,                    // f0
+        0.02,                   // K
+        0.001,                  // eps
+        0.6,                    // damping
+        1.2);                   // dilation
+    sync_type *sync = new sync_type(graph, 8);
+
+    for (int k = 0; k <= epochs; k++) {
+        // the last snapshot is empty
+        int n = (k < epochs)? randint(n_vertex / 4, n_vertex): 0;
+        std::vector<sync_type::key_type> keys;
+        std::set<sync_type::key_type> unique;
+        for (int i = 0; i < n; i++) {
+            keys.push_back(randint(0, 2 * n_vertex));
+            unique.insert(keys.back());
+        }
+        std::vector<sync_type::edge_rec> es;
+        for (int i = 0; i < 2 * n; i++) {
+            es.push_back({ keys[randint(0, n - 1)],
+                    (sync_type::key_type) randint(0, 2 * n_vertex), 1.0 });
+        }
+
+        sync_type::delta d = sync->update(keys, es);
+        printf("[SNAPSHOT (%d)]: +%lu -%lu vertices, +%lu -%lu edges\n", k,
+            d.vertices_added, d.vertices_removed, d.edges_added, d.edges_removed);
+        for (int i = 0; i < 10; i++) graph->layout(1.0);
+
+        if (graph->g->vs.size() != unique.size()) {
+            printf("!!! SNAPSHOT SIZE CHECK FAILED !!!\n");
+            exit(-1);
+        }
+        for (auto key : unique) {
+            if (!sync->find(key)) {
+                printf("!!! SNAPSHOT KEY CHECK FAILED !!!\n");
+                exit(-1);
+            }
+        }
+        if (!verify_integrity(graph)) {
+            printf("!!! INTEGRITY CHECK FAILED !!!\n");
+            exit(-1);
+        }
+        if (!verify_matching(graph)) {
+            printf("!!! MATCHING CHECK FAILED !!!\n");
+            exit(-1);
+        }
+    }
+
+    delete sync;
+    delete graph;
+}
+
+// 
+// Lay out the same random tree with distributed_layout on one process and on
+// n_procs processes, both have to settle at about the same mean edge length
+// 
+double distributed_edge_length(int n_procs, int n_vertex, int iterations)
+{
+    graph_type *graph = new graph_type(1, 
+        250,                    // f0
+        0.02,                   // K
+        0.001,                  // eps
+        0.6,                    // damping
+        1.2);                   // dilation
+
+    srand(n_vertex);
+    std::vector<vertex_type *> vs;
+    for (int k = 0; k < n_vertex; k++) {
+        auto v = new vertex_styled<_float_type>(
+            randint(-100, 100),
+            randint(-100, 100),
+            randint(-100, 100));
+        graph->add_vertex(v);
+        vs.push_back(v);
+        if (k > 0) graph->add_edge(
+            new edge_styled<_float_type>(vs[randint(0, k - 1)], v));
+    }
+
+    distributed_layout<_float_type> layout(graph, n_procs);
+    double max_ddx = layout.run(iterations, 1.0);
+
+    double length = 0;
+    for (auto v : vs) {
+        for (auto e : v->es) {
+            if (e->a == v) length += (e->a->x - e->b->x).mod();
+        }
+    }
+    length /= n_vertex - 1;
+    printf("[DISTRIBUTED (%d processes)]: max_ddx %f, mean edge length %f\n",
+        n_procs, max_ddx, length);
+    if (!std::isfinite(max_ddx) or !std::isfinite(length)) {
+        printf("!!! DISTRIBUTED LAYOUT CHECK FAILED !!!\n");
+        exit(-1);
+    }
+
+    delete graph;
+    return length;
+}
+
+void distributed_test(int n_procs, int n_vertex, int iterations)
+{
+    double l1 = distributed_edge_length(1, n_vertex, iterations);
+    double ln = distributed_edge_length(n_procs, n_vertex, iterations);
+    if (ln < 0.5 * l1 or ln > 2 * l1) {
+        printf("!!! DISTRIBUTED LAYOUT CHECK FAILED !!!\n");
+        exit(-1);
+    }
+}
+
+// 
+// Load a random tree into a mapped graph which already has vertices, lay it out
+// there and store it back. The stored positions must be the ones of the loaded
+// vertices, and the mean edge length about the one reached by graph::layout
+// 
+void mapped_test(int n_vertex, int iterations)
+{
+    graph_type *graph = new graph_type(1, 
+        250,                    // f0
+        0.02,                   // K
+        0.001,                  // eps
+        0.6,                    // damping
+        1.2);                   // dilation
+
+    std::vector<vertex_type *> vs;
+    for (int k = 0; k < n_vertex; k++) {
+        auto v = new vertex_styled<_float_type>(
+            randint(-100, 100),
+            randint(-100, 100),
+            randint(-100, 100));
+        graph->add_vertex(v);
+        vs.push_back(v);
+        if (k > 0) graph->add_edge(
+            new edge_styled<_float_type>(vs[randint(0, k - 1)], v));
+    }
+    auto mean_length = [&](void) {
+        double length = 0;
+        for (auto v : vs) {
+            for (auto e : v->es) {
+                if (e->a == v) length += (e->a->x - e->b->x).mod();
+            }
+        }
+        return length / (n_vertex - 1);
+    };
+
+    char dir[] = "/tmp/galaster_mapped_XXXXXX";
+    if (!mkdtemp(dir)) {
+        perror("mkdtemp");
+        exit(-1);
+    }
+    auto mapped = new mapped_graph<_float_type>(dir, 250, 0.02, 0.001, 0.6);
+    mapped->add_vertices(10);
+    size_t first = mapped->load(graph);
+    for (int k = 0; k < iterations; k++) mapped->layout(1.0);
+    mapped->store(graph, first);
+    for (int k = 0; k < n_vertex; k++) {
+        if ((vs[k]->x - mapped->position(first + k)).mod() > 1e-6) {
+            printf("!!! MAPPED STORE CHECK FAILED !!!\n");
+            exit(-1);
+        }
+    }
+    double l_mapped = mean_length();
+    delete mapped;
+    system((std::string("rm -rf ") + dir).c_str());
+
+    for (int k = 0; k < iterations; k++) graph->layout(1.0);
+    double l_graph = mean_length();
+    printf("[MAPPED]: mean edge length %f, %f with graph::layout\n",
+        l_mapped, l_graph);
+    if (!std::isfinite(l_mapped) or l_mapped < 0.5 * l_graph or l_mapped > 2 * l_graph) {
+        printf("!!! MAPPED LAYOUT CHECK FAILED !!!\n");
+        exit(-1);
+    }
+
+    delete graph;
+}
+
 
 #ifdef __APPLE__
 void check_for_leaks(void)
@@ -175,6 +772,19 @@ int main(int argc, char *argv[])
     int n_vertex = 100;
     int n_edges = 3;
     random_test(n_layer, n_vertex, n_vertex * n_edges * 2);
+    bulk_test(5, 3000, 10);
+    focus_spline_test(n_layer, 10);
+    batch_kernel_test(1);
+    batch_kernel_test(1027);
+    timer_wheel_test();
+    key_index_test(1000, 100000);
+    snapshot_test(n_layer, n_vertex, 20);
+    distributed_test(4, 1000, 300);
+    mapped_test(1000, 300);
+    model_test<2, spring_electrical>("2D SPRING ELECTRICAL", 250, 0.02, 2000, 300);
+    model_test<3, fruchterman_reingold>("FRUCHTERMAN REINGOLD", 250, 0.02, 1000, 300);
+    model_test<3, linlog>("LINLOG", 1, 0.2, 1000, 300);
+    model_test<2, force_atlas2>("2D FORCE ATLAS 2", 1, 0.2, 1000, 300);
     // layout_test(n_layer, n_vertex, n_edges);
 
     vector3d<float> v0(1,2,3), v1(4,5,6);
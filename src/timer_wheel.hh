@@ -0,0 +1,151 @@
+#ifndef _TIMER_WHEEL_H_
+#define _TIMER_WHEEL_H_
+
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+
+// 
+// Link of an element in a timer wheel, embedded in the element. Links of a slot
+// form a circular list around the head of the slot, so a link can be unlinked
+// without knowing its wheel, which happens when the element is destroyed
+// 
+template <typename _owner_type>
+struct timer_link
+{
+    timer_link(void) = default;
+    timer_link(const timer_link &) = delete;
+    ~timer_link(void) {
+        unlink();
+    }
+
+    bool scheduled(void) const { return prev != nullptr; }
+
+    void unlink(void)
+    {
+        if (!prev) return;
+        prev->next = next;
+        next->prev = prev;
+        prev = next = nullptr;
+    }
+
+    _owner_type *owner = nullptr;
+    uint64_t due = 0;               // tick the element expires at
+    timer_link *prev = nullptr;
+    timer_link *next = nullptr;
+};
+
+
+// 
+// Hierarchical timer wheel: `levels` wheels of 2^bits slots, level l holding the
+// elements due in less than 2^(bits * (l + 1)) ticks. Advancing a tick expires the
+// current slot of level 0, and whenever a level wraps around the current slot of
+// the next level is cascaded into the lower levels. Scheduling and cancelling take
+// constant time, advancing takes time linear in the number of ticks and expired
+// elements, regardless of the number of elements scheduled
+// 
+template <typename _owner_type>
+class timer_wheel
+{
+public:
+    typedef timer_link<_owner_type> link_type;
+    static const int bits = 6;
+    static const int levels = 4;
+    static const uint64_t n_slots = uint64_t(1) << bits;
+    static const uint64_t mask = n_slots - 1;
+
+    timer_wheel(uint64_t now = 0)
+        : now(now), heads(levels * n_slots)
+    {
+        for (auto &h : heads) h.prev = h.next = &h;
+    }
+    timer_wheel(const timer_wheel &) = delete;
+    ~timer_wheel(void) {
+        for (auto &h : heads) {
+            while (h.next != &h) h.next->unlink();
+        }
+    }
+
+    // schedule the link to expire at tick due, at the next tick if due is not later
+    // than current tick. t is the time now: an idle (empty) wheel isn't advanced,
+    // so it first jumps to t, or the next advance() would step through every tick
+    // the wheel has been idle for
+    void schedule(link_type *link, uint64_t due, uint64_t t)
+    {
+        link->unlink();
+        if (t > now and empty()) now = t;
+        link->due = std::max(due, now + 1);
+        place(link);
+    }
+
+    // advance to tick t, appending owners of expired links to expired
+    void advance(uint64_t t, std::vector<_owner_type *> &expired)
+    {
+        if (empty()) {
+            now = std::max(now, t);
+            return;
+        }
+        while (now < t) {
+            now += 1;
+            // levels wrapping around at this tick are cascaded top down, so that
+            // links land in the current slots of lower levels before those are
+            // cascaded or expired
+            int top = 0;
+            while (top + 1 < levels and
+                (now & ((uint64_t(1) << (bits * (top + 1))) - 1)) == 0) top++;
+            for (int l = top; l > 0; l--) {
+                link_type &h = head(l, now >> (bits * l));
+                while (h.next != &h) {
+                    link_type *link = h.next;
+                    link->unlink();
+                    place(link);
+                }
+            }
+            link_type &h = head(0, now);
+            while (h.next != &h) {
+                link_type *link = h.next;
+                link->unlink();
+                expired.push_back(link->owner);
+            }
+        }
+    }
+
+    bool empty(void) const
+    {
+        for (auto &h : heads) {
+            if (h.next != &h) return false;
+        }
+        return true;
+    }
+
+    uint64_t tick(void) const { return now; }
+
+protected:
+    link_type &head(int level, uint64_t t) {
+        return heads[level * n_slots + (t & mask)];
+    }
+
+    // put a link into the slot of its due tick at the lowest level spanning it,
+    // links due beyond the top level wait in the top level and are cascaded again
+    void place(link_type *link)
+    {
+        uint64_t horizon = (uint64_t(1) << (bits * levels)) - 1;
+        uint64_t due = std::min(std::max(link->due, now), now + horizon);
+        uint64_t delta = due - now;
+        int l = 0;
+        while (l < levels - 1 and delta >= (uint64_t(1) << (bits * (l + 1)))) l++;
+        link_type &h = head(l, due >> (bits * l));
+        link->prev = h.prev;
+        link->next = &h;
+        h.prev->next = link;
+        h.prev = link;
+    }
+
+    uint64_t now;
+    std::vector<link_type> heads;
+};
+
+
+#endif /* _TIMER_WHEEL_H_ */
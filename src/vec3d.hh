@@ -22,109 +22,123 @@ inline double rand_range(double from, double to) {
 }
 
 
-// Baseline implementation for all real types
-template <typename _float_type>
+// 
+// Baseline implementation for all real types. The dimension could be 3, or 2 for
+// planar layouts, in which case z coordinates are ignored on construction and
+// read back as 0, so that the same code serves both cases
+// 
+template <typename _float_type, int _dim = 3>
 class vector3d {
 public:
+    static_assert(_dim == 2 or _dim == 3, "vector3d is either 2D or 3D");
+
     vector3d(_float_type x, _float_type y, _float_type z) {
-        v[0] = x;
-        v[1] = y;
-        v[2] = z;
+        _float_type c[3] = { x, y, z };
+        for (int i = 0; i < _dim; i++) v[i] = c[i];
     }
     typedef _float_type coord_type;
-    static const vector3d<_float_type> zero;
-    coord_type v[3];
+    static const int dim = _dim;
+    static const vector3d zero;
+    coord_type v[_dim];
 
-    vector3d<_float_type>& operator *= (_float_type a) {
-        v[0] *= a;
-        v[1] *= a;
-        v[2] *= a;
+    vector3d& operator *= (_float_type a) {
+        for (int i = 0; i < _dim; i++) v[i] *= a;
         return *this;
     }
 
-    vector3d<_float_type>& operator += (const vector3d<_float_type> &r) {
-        v[0] += r.v[0];
-        v[1] += r.v[1];
-        v[2] += r.v[2];
+    vector3d& operator += (const vector3d &r) {
+        for (int i = 0; i < _dim; i++) v[i] += r.v[i];
         return *this;
     }
 
-    vector3d<_float_type>& operator -= (const vector3d<_float_type> &r) {
-        v[0] -= r.v[0];
-        v[1] -= r.v[1];
-        v[2] -= r.v[2];
+    vector3d& operator -= (const vector3d &r) {
+        for (int i = 0; i < _dim; i++) v[i] -= r.v[i];
         return *this;
     }
 
     void bound(_float_type b) {
-        v[0] = std::max(std::min(v[0], b), -b);
-        v[1] = std::max(std::min(v[1], b), -b);
-        v[2] = std::max(std::min(v[2], b), -b);
+        for (int i = 0; i < _dim; i++) v[i] = std::max(std::min(v[i], b), -b);
     }
 
     void coord(_float_type &x, _float_type &y, _float_type &z) const {
-        x = v[0];
-        y = v[1];
-        z = v[2];
+        _float_type c[3] = { 0, 0, 0 };
+        for (int i = 0; i < _dim; i++) c[i] = v[i];
+        x = c[0];
+        y = c[1];
+        z = c[2];
     }
 
     _float_type mod(void) const {
-        return sqrt(v[0]*v[0] + v[1]*v[1] + v[2]*v[2]);
+        return sqrt(dot(*this));
     }
 
     _float_type rmod(void) const {
         return 1 / mod();
     }
 
-    vector3d<_float_type> normalized() const {
+    vector3d normalized() const {
         _float_type k = 1 / mod();
         return k * (*this);
     }
 
-    _float_type dot(const vector3d<_float_type> &rhs) const {
-        return rhs.v[0] * v[0] + rhs.v[1] * v[1] + rhs.v[2] * v[2];
+    _float_type dot(const vector3d &rhs) const {
+        _float_type r = 0;
+        for (int i = 0; i < _dim; i++) r += rhs.v[i] * v[i];
+        return r;
     }
 
-    vector3d<_float_type> cross(const vector3d<_float_type> &rhs) const {
-        _float_type x = v[1] * rhs.v[2] - v[2] * rhs.v[1];
-        _float_type y = v[2] * rhs.v[0] - v[0] * rhs.v[2];
-        _float_type z = v[0] * rhs.v[1] - v[1] * rhs.v[0];
-        return vector3d<_float_type>(x, y, z);
+    // cross product in 3D, the z component is dropped for 2D vectors
+    vector3d cross(const vector3d &rhs) const {
+        _float_type a[3], b[3];
+        coord(a[0], a[1], a[2]);
+        rhs.coord(b[0], b[1], b[2]);
+        _float_type x = a[1] * b[2] - a[2] * b[1];
+        _float_type y = a[2] * b[0] - a[0] * b[2];
+        _float_type z = a[0] * b[1] - a[1] * b[0];
+        return vector3d(x, y, z);
     }
 };
 
-template <typename _float_type>
-const vector3d<_float_type> vector3d<_float_type>::zero(.0, .0, .0);
+template <typename _float_type, int _dim>
+const vector3d<_float_type, _dim> vector3d<_float_type, _dim>::zero(.0, .0, .0);
+
 
-template <typename _float_type>
-vector3d<_float_type> operator * (_float_type a, const vector3d<_float_type> &x)
+// 
+// Arithmetic operators, defined in the header for all vector types (including the
+// SSE specialization below) so that they can be inlined into the layout loops.
+// Kernels processing many vectors at once are in vec_batch.hh
+// 
+template <typename _float_type, int _dim>
+vector3d<_float_type, _dim> operator * (
+    _float_type a, const vector3d<_float_type, _dim> &x)
 {
-    vector3d<_float_type> res(x);
+    vector3d<_float_type, _dim> res(x);
     res *= a;
     return res;
 }
 
-template <typename _float_type>
-vector3d<_float_type> operator * (const vector3d<_float_type> &x, _float_type a)
+template <typename _float_type, int _dim>
+vector3d<_float_type, _dim> operator * (
+    const vector3d<_float_type, _dim> &x, _float_type a)
 {
     return a * x;
 }
 
 
-template <typename _float_type>
-vector3d<_float_type> operator + (
-    const vector3d<_float_type> &a, const vector3d<_float_type> &b)
+template <typename _float_type, int _dim>
+vector3d<_float_type, _dim> operator + (
+    const vector3d<_float_type, _dim> &a, const vector3d<_float_type, _dim> &b)
 {
-    vector3d<_float_type> c(a);
+    vector3d<_float_type, _dim> c(a);
     c += b;
     return c;
 }
 
-template <typename _float_type>
-vector3d<_float_type> operator - (
-    const vector3d<_float_type> &a, const vector3d<_float_type> &b)
+template <typename _float_type, int _dim>
+vector3d<_float_type, _dim> operator - (
+    const vector3d<_float_type, _dim> &a, const vector3d<_float_type, _dim> &b)
 {
-    vector3d<_float_type> c(a);
+    vector3d<_float_type, _dim> c(a);
     c -= b;
     return c;
 }
@@ -134,7 +148,7 @@ vector3d<_float_type> operator - (
 #ifdef SSE_INTRINSINC
 
 template <>
-class vector3d<float> {
+class vector3d<float, 3> {
 public:
     typedef typename std::aligned_storage<4, 16>::type sse_aligned[4];
     vector3d(float x, float y, float z) {
@@ -150,6 +164,7 @@ public:
         : v(v) {
     }
     typedef float coord_type;
+    static const int dim = 3;
     static const vector3d<float> zero;
     __m128 v;
 
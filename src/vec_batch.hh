@@ -0,0 +1,116 @@
+#ifndef _VEC_BATCH_H_
+#define _VEC_BATCH_H_
+
+
+#include "vec3d.hh"
+#include <algorithm>
+#include <vector>
+
+
+// 
+// Kernels over batches of coordinates stored as structures of arrays, i.e. one
+// array per axis. Each kernel is compiled for AVX-512, AVX2 and the baseline of the
+// build, and the loader picks the widest one the CPU supports (function
+// multiversioning of GCC on x86-64 Linux, other builds only get the baseline), so
+// that a kernel processes 16, 8 or 4 floats (8, 4 or 2 doubles) per instruction
+// whatever machine the program was built on. Calls through the dispatch can't be
+// inlined, kernels are meant to be called on whole ranges. vector3d is still the
+// type for single vectors
+// 
+#if defined(__GNUC__) && !defined(__clang__) && defined(__x86_64__) && \
+    defined(__linux__)
+#define VEC_BATCH_KERNEL __attribute__((target_clones("avx512f", "avx2", "default")))
+#else
+#define VEC_BATCH_KERNEL
+#endif
+
+
+// delta[i] = a * u[i] + b * w[i] bounded to [-bound, bound], and x[i] += delta[i]
+template <typename T>
+VEC_BATCH_KERNEL void batch_bounded_add(
+    T *x, T *delta, const T *u, const T *w, T a, T b, T bound, size_t n)
+{
+#pragma omp simd
+    for (size_t i = 0; i < n; i++) {
+        T d = a * u[i] + b * w[i];
+        d = std::max(std::min(d, bound), -bound);
+        delta[i] = d;
+        x[i] += d;
+    }
+}
+
+
+// velocity verlet: dx[i] = damping * (dx[i] + h * (ddx[i] + acc[i])), ddx[i] = acc[i]
+template <typename T>
+VEC_BATCH_KERNEL void batch_verlet(
+    T *dx, T *ddx, const T *acc, T h, T damping, size_t n)
+{
+#pragma omp simd
+    for (size_t i = 0; i < n; i++) {
+        dx[i] = damping * (dx[i] + h * (ddx[i] + acc[i]));
+        ddx[i] = acc[i];
+    }
+}
+
+
+// smallest and largest of x[0, n), n > 0
+template <typename T>
+VEC_BATCH_KERNEL void batch_bounds(const T *x, size_t n, T &lo, T &hi)
+{
+    T l = x[0], h = x[0];
+#pragma omp simd reduction(min: l) reduction(max: h)
+    for (size_t i = 0; i < n; i++) {
+        l = std::min(l, x[i]);
+        h = std::max(h, x[i]);
+    }
+    lo = l;
+    hi = h;
+}
+
+
+// 
+// A batch of vectors stored as a structure of arrays, for the kernels above
+// 
+template <typename _float_type, int _dim = 3>
+class vector_batch
+{
+public:
+    typedef _float_type float_type;
+    typedef vector3d<_float_type, _dim> vector3d_type;
+    static const int dim = _dim;
+
+    size_t size(void) const { return n; }
+
+    void resize(size_t n) {
+        this->n = n;
+        for (int k = 0; k < _dim; k++) c[k].resize(n);
+    }
+
+    void set(size_t i, _float_type x, _float_type y, _float_type z) {
+        _float_type xyz[3] = { x, y, z };
+        for (int k = 0; k < _dim; k++) c[k][i] = xyz[k];
+    }
+
+    void set(size_t i, const vector3d_type &x) {
+        _float_type xyz[3];
+        x.coord(xyz[0], xyz[1], xyz[2]);
+        for (int k = 0; k < _dim; k++) c[k][i] = xyz[k];
+    }
+
+    vector3d_type get(size_t i) const {
+        _float_type xyz[3] = { 0, 0, 0 };
+        for (int k = 0; k < _dim; k++) xyz[k] = c[k][i];
+        return vector3d_type(xyz[0], xyz[1], xyz[2]);
+    }
+
+    // coordinates of the k-th axis of all points
+    _float_type *operator [] (int k) { return c[k].data(); }
+    const _float_type *operator [] (int k) const { return c[k].data(); }
+
+private:
+    size_t n = 0;
+    std::vector<_float_type> c[_dim];
+};
+
+
+#endif /* _VEC_BATCH_H_ */
@@ -6,8 +6,8 @@
 
 
 // for debugging
-template <typename _coord_type>
-int nd_edges(layer<_coord_type> *layer)
+template <typename _coord_type, int _dim, typename _force_model>
+int nd_edges(layer<_coord_type, _dim, _force_model> *layer)
 {
     int n = 0;
     for (auto v : layer->vs) {
@@ -19,14 +19,14 @@ int nd_edges(layer<_coord_type> *layer)
 }
 
 
-template <typename _coord_type>
-bool verify_integrity(layer<_coord_type> *layer)
+template <typename _coord_type, int _dim, typename _force_model>
+bool verify_integrity(layer<_coord_type, _dim, _force_model> *layer)
 {
     if (!layer->coarser) return true;
     for (auto v : layer->vs) {
         for (auto e : v->es) {
-            vertex<_coord_type> *a = e->a, *b = e->b;
-            vertex<_coord_type> *ca = a->coarser, *cb = b->coarser;
+            vertex<_coord_type, _dim> *a = e->a, *b = e->b;
+            vertex<_coord_type, _dim> *ca = a->coarser, *cb = b->coarser;
             if (ca->shared_edge(cb) == nullptr)
                 return false;
         }
@@ -34,8 +34,8 @@ bool verify_integrity(layer<_coord_type> *layer)
     return nd_edges(layer) == nd_edges(layer->coarser);
 }
 
-template <typename _coord_type>
-bool verify_integrity(graph<_coord_type> *graph)
+template <typename _coord_type, int _dim, typename _force_model>
+bool verify_integrity(graph<_coord_type, _dim, _force_model> *graph)
 {
     for (auto layer : graph->layers) {
         if (!verify_integrity(layer)) return false;
@@ -44,8 +44,8 @@ bool verify_integrity(graph<_coord_type> *graph)
 }
 
 
-template <typename _coord_type>
-bool verify_redundancy(layer<_coord_type> *layer)
+template <typename _coord_type, int _dim, typename _force_model>
+bool verify_redundancy(layer<_coord_type, _dim, _force_model> *layer)
 {
     if (!layer->coarser) return true;
     for (auto cv : layer->coarser->vs) {
@@ -61,8 +61,8 @@ bool verify_redundancy(layer<_coord_type> *layer)
     return true;
 }
 
-template <typename _coord_type>
-bool verify_redundancy(graph<_coord_type> *graph)
+template <typename _coord_type, int _dim, typename _force_model>
+bool verify_redundancy(graph<_coord_type, _dim, _force_model> *graph)
 {
     for (auto layer : graph->layers) {
         if (!verify_redundancy(layer)) return false;
@@ -71,8 +71,63 @@ bool verify_redundancy(graph<_coord_type> *graph)
 }
 
 
-template <typename _coord_type>
-void dump_graphviz(const layer<_coord_type> *layer, const std::string &filename)
+// lists of finer vertices of coarser vertices must agree with the coarser links
+template <typename _coord_type, int _dim, typename _force_model>
+bool verify_matching(layer<_coord_type, _dim, _force_model> *layer)
+{
+    if (!layer->coarser) return true;
+    size_t n_finer = 0;
+    for (auto cv : layer->coarser->vs) n_finer += cv->finer.size();
+    if (n_finer != layer->vs.size()) return false;
+    for (auto v : layer->vs) {
+        auto cv = v->coarser;
+        if (v->finer_index < 0 or v->finer_index >= (int) cv->finer.size() or
+            cv->finer[v->finer_index] != v) return false;
+    }
+    return true;
+}
+
+template <typename _coord_type, int _dim, typename _force_model>
+bool verify_matching(graph<_coord_type, _dim, _force_model> *graph)
+{
+    for (auto layer : graph->layers) {
+        if (!verify_matching(layer)) return false;
+    }
+    return true;
+}
+
+
+// indices of the edges of hubs must list each incident edge at its position
+template <typename _coord_type, int _dim, typename _force_model>
+bool verify_adjacency(layer<_coord_type, _dim, _force_model> *layer)
+{
+    for (auto v : layer->vs) {
+        if (!v->adjacency) {
+            if (v->es.size() > ADJACENCY_INDEX_THRESHOLD) return false;
+            continue;
+        }
+        if (v->adjacency->size() != v->es.size()) return false;
+        for (auto &p : *v->adjacency) {
+            auto e = v->es[p.second];
+            if (p.first != ((e->a == v)? e->b: e->a)) return false;
+        }
+    }
+    return true;
+}
+
+template <typename _coord_type, int _dim, typename _force_model>
+bool verify_adjacency(graph<_coord_type, _dim, _force_model> *graph)
+{
+    for (auto layer : graph->layers) {
+        if (!verify_adjacency(layer)) return false;
+    }
+    return true;
+}
+
+
+template <typename _coord_type, int _dim, typename _force_model>
+void dump_graphviz(
+    const layer<_coord_type, _dim, _force_model> *layer, const std::string &filename)
 {
     FILE *fp = fopen(filename.c_str(), "w+");
     fprintf(fp, "digraph G {\n");
@@ -3,15 +3,54 @@
 
 #include "vec3d.hh"
 #include "prop.hh"
+#include "timer_wheel.hh"
 #include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
 #include <vector>
 #include <string>
 #include <assert.h>
 
 
-template <typename _coord_type>
+// 
+// Vertices with more incident edges than this keep a hashed index of their edges by
+// neighbour, so that looking up, connecting and disconnecting an edge of a hub takes
+// constant time instead of a scan over its edges. The index is dropped again when
+// the degree falls below half of the threshold.
+// 
+#define ADJACENCY_INDEX_THRESHOLD 32
+
+
+template <typename _coord_type, int _dim = 3>
 class edge;
 
+template <typename _coord_type, int _dim = 3>
+struct spring;
+
+
+// 
+// Handle of a vertex in a layer: the slot of the vertex in the slot map of the layer
+// and the generation of the slot when the handle was taken. A handle can be kept
+// after its vertex is removed, it resolves to nullptr from then on even if the slot
+// is reused by another vertex (see layer::get)
+// 
+struct vertex_handle
+{
+    vertex_handle(void) = default;
+    vertex_handle(uint32_t slot, uint32_t generation)
+        : slot(slot), generation(generation) {
+    }
+
+    uint32_t slot = UINT32_MAX;
+    uint32_t generation = 0;
+
+    bool operator==(const vertex_handle &h) const {
+        return slot == h.slot and generation == h.generation;
+    }
+    bool operator!=(const vertex_handle &h) const { return !(*this == h); }
+};
+
 
 // 
 // Vertex type definitions
@@ -19,13 +58,13 @@ class edge;
 //   vertex_styled: vertex in finest layer, with style info for rendering
 // 
 
-template <typename _coord_type>
+template <typename _coord_type, int _dim = 3>
 class vertex
 {
 public:
-    typedef vector3d<_coord_type> vector3d_type;
-    typedef vertex<_coord_type> vertex_type;
-    typedef edge<_coord_type> edge_type;
+    typedef vector3d<_coord_type, _dim> vector3d_type;
+    typedef vertex<_coord_type, _dim> vertex_type;
+    typedef edge<_coord_type, _dim> edge_type;
 
     vertex(_coord_type x, _coord_type y, _coord_type z)
         : id(vertex_id++),
@@ -48,6 +87,10 @@ public:
     // (coarsen) specified edge
     bool neihash(const edge_type *new_e) const;
 
+    // add/remove edge e to/from the incident edges of this vertex
+    void attach_edge(edge_type *e);
+    void detach_edge(edge_type *e);
+
 #ifdef SSE_INTRINSINC
     void *operator new (size_t size) {
         void *p = _mm_malloc(size, 16);
@@ -69,26 +112,58 @@ public:
     vector3d_type delta = vector3d_type::zero;
     vertex *coarser = nullptr;
     std::vector<edge_type *> es;
+
+    // positions in es of the edges to each neighbour, only for vertices with more
+    // than ADJACENCY_INDEX_THRESHOLD edges
+    typedef std::unordered_multimap<const vertex *, size_t> adjacency_index_type;
+    std::unique_ptr<adjacency_index_type> adjacency;
+
+    // position of this vertex in the vertices of its layer, and its slot in the slot
+    // map of the layer, both maintained by the layer
+    long vs_index = -1;
+    uint32_t slot = UINT32_MAX;
+
+    // physics flags: pinned vertices repel other vertices but are never moved,
+    // inactive vertices are left out of the layout entirely. Flags of coarser
+    // vertices are derived from their finer vertices before each layout
+    bool pinned = false;
+    bool active = true;
+
+    // union-find links maintained by the layer for tracking connected components
+    vertex *comp_parent = this;
+    int comp_size = 1;
+    int comp_index = -1;
+
+    // finer vertices matched into this vertex (maintained by the finer layer), the
+    // position of this vertex in the list of its coarser vertex, and the epoch of
+    // last search of matched components that visited this vertex
+    std::vector<vertex *> finer;
+    int finer_index = -1;
+    unsigned mark = 0;
 };
 
-template <typename _coord_type>
-int vertex<_coord_type>::vertex_id;
+template <typename _coord_type, int _dim>
+int vertex<_coord_type, _dim>::vertex_id;
 
 
-template <typename _coord_type>
-class vertex_styled : public vertex<_coord_type>
+template <typename _coord_type, int _dim = 3>
+class vertex_styled : public vertex<_coord_type, _dim>
 {
 public:
     vertex_styled(_coord_type x, _coord_type y, _coord_type z)
-        : vertex<_coord_type>(x, y, z) {
+        : vertex<_coord_type, _dim>(x, y, z) {
     }
-    vertex_styled(const vector3d<_coord_type> &x)
-        : vertex<_coord_type>(x) {
+    vertex_styled(const vector3d<_coord_type, _dim> &x)
+        : vertex<_coord_type, _dim>(x) {
     }
 
     // render this vertex via OpenGL
     void render(void) const;
 
+    // aggregated springs of edges incident to this vertex, maintained by the
+    // finest layer
+    std::vector<spring<_coord_type, _dim> *> springs;
+
     shape_type shape = shape_type::cube;
     color_type color = color_type::blue;
     double size = 1.0;
@@ -98,6 +173,11 @@ public:
     color_type font_color = color_type::white;
     int font_size = 16;
     bool visible = true;
+
+    // seconds this vertex lives once added to a graph, forever if not positive. An
+    // expired vertex is removed from the graph and deleted along with its edges
+    double ttl = 0;
+    timer_link<vertex<_coord_type, _dim>> expiry;
 };
 
 
@@ -107,12 +187,12 @@ public:
 //   edge_styled: edges in finest layer, with style info, not reference counted
 // 
 
-template <typename _coord_type>
+template <typename _coord_type, int _dim>
 class edge
 {
 public:
-    typedef vertex<_coord_type> vertex_type;
-    typedef vector3d<_coord_type> vector3d_type;
+    typedef vertex<_coord_type, _dim> vertex_type;
+    typedef vector3d<_coord_type, _dim> vector3d_type;
 
     edge(vertex_type *a, vertex_type *b, 
         bool refcounted = true, bool oriented = false)
@@ -122,31 +202,34 @@ public:
     edge(const edge &) = delete;
     virtual ~edge(void) = default;
 
-    // Connect/Disconnect the edge from a to b
-    edge<_coord_type> *connect(void);
-    void disconnect(void);
+    // Connect/Disconnect the edge from a to b. Edge objects left unused (this edge
+    // if connect returns another one, or if disconnect returns true) are disposed
+    // of by the caller, which knows how they were allocated
+    edge<_coord_type, _dim> *connect(void);
+    bool disconnect(void);
         
-    vertex<_coord_type> * const a;
-    vertex<_coord_type> * const b;
-    _coord_type strength = 1.0;
+    vertex<_coord_type, _dim> * const a;
+    vertex<_coord_type, _dim> * const b;
+    _coord_type strength = 1.0;    // changed with graph::set_strength once added
     int cnt = 0;
     bool refcounted: 1;
     bool oriented: 1;
 };
 
 
-template <typename _coord_type>
-class edge_styled : public edge<_coord_type>
+template <typename _coord_type, int _dim = 3>
+class edge_styled : public edge<_coord_type, _dim>
 {
 public:
-    typedef vertex<_coord_type> vertex_type;
-    typedef vector3d<_coord_type> vector3d_type;
+    typedef vertex<_coord_type, _dim> vertex_type;
+    typedef vector3d<_coord_type, _dim> vector3d_type;
 
     edge_styled(vertex_type *a, vertex_type *b)
-        : edge<_coord_type>(a, b, false, false),
+        : edge<_coord_type, _dim>(a, b, false, false),
           visible(true), 
           arrow(false), arrow_reverse(false),
-          spline(false), showstrain(false), blendcolor(false) {
+          spline(false), showstrain(false), blendcolor(false),
+          in_spring(false) {
     }
 
     virtual ~edge_styled(void) {
@@ -173,6 +256,7 @@ public:
     bool spline: 1;
     bool showstrain: 1;
     bool blendcolor: 1;
+    bool in_spring: 1;          // counted in an aggregated spring of the layer
     double arrow_position = 0.5;
     double arrow_radius = 1.0;
     double arrow_length = 1.0;
@@ -184,40 +268,69 @@ public:
     stroke_type stroke = stroke_type::solid;
     double width = 1.0;
 
+    // seconds this edge lives once added to a graph, forever if not positive. An
+    // expired edge is removed from the graph, which deletes it
+    double ttl = 0;
+    timer_link<edge<_coord_type, _dim>> expiry;
+
+    // strength this edge contributes to its aggregated spring, i.e. its strength
+    // when it was added or last set with graph::set_strength
+    _coord_type spring_strength = 0;
+
     // 
     // centroid position of spline edge. this centroid is represented as a
     // specialized vertex and involves the calculation of force-directed layout in
     // the finest layer
     // 
-    class vertex_spline_centroid : public vertex<_coord_type> {
+    class vertex_spline_centroid : public vertex<_coord_type, _dim> {
     public:
-        vertex_spline_centroid(edge_styled<_coord_type> *e) 
-            : vertex<_coord_type>(_coord_type(0.5) * (e->a->x + e->b->x)),
+        vertex_spline_centroid(edge_styled<_coord_type, _dim> *e) 
+            : vertex<_coord_type, _dim>(_coord_type(0.5) * (e->a->x + e->b->x)),
               e_spline(e) {
-            this->es.push_back(new edge<_coord_type>(this, e->a, false, false));
+            this->es.push_back(new edge<_coord_type, _dim>(this, e->a, false, false));
             if (e->a != e->b)
                 this->es.push_back(
-                    new edge<_coord_type>(this, e->b, false, false));
+                    new edge<_coord_type, _dim>(this, e->b, false, false));
         }
         virtual ~vertex_spline_centroid(void) {
             for (auto e : this->es) delete e;
         }
-        edge_styled<_coord_type> *e_spline;
+        edge_styled<_coord_type, _dim> *e_spline;
     } *vspline = nullptr;
 
 protected:
     void render_arrow(
-        const vector3d_type &arrow_dir, 
+        const vector3d<_coord_type, 3> &arrow_dir,
         GLfloat ax, GLfloat ay, GLfloat az) const;
 };
 
 
+// 
+// Aggregated spring of all parallel (non-spline) styled edges between a pair of
+// vertices in the finest layer, so that the spring force of the pair is evaluated
+// once regardless of the number of edges. Strength, orientation and spline flag of
+// an edge are taken into account when the edge is added to the graph
+// 
+template <typename _coord_type, int _dim>
+struct spring
+{
+    vertex<_coord_type, _dim> *a, *b;
+    _coord_type strength = 0;   // summed strength of the edges
+    int oriented = 0;           // number of oriented edges a->b minus b->a
+    int cnt = 0;                // number of edges
+};
+
+
 // Find the first edge shared by this vertex (notated as a) and b (a->b or b->a),
 // this is maily for testing if a and b is connected or not
-template <typename _coord_type>
-edge<_coord_type> *
-vertex<_coord_type>::shared_edge(const vertex<_coord_type> *b) const
+template <typename _coord_type, int _dim>
+edge<_coord_type, _dim> *
+vertex<_coord_type, _dim>::shared_edge(const vertex<_coord_type, _dim> *b) const
 {
+    if (adjacency) {
+        auto p = adjacency->find(b);
+        return (p != adjacency->end())? es[p->second]: nullptr;
+    }
     for (auto e: es) {
         if ((e->a == this and e->b == b) or
             (e->b == this and e->a == b)) return e;
@@ -226,10 +339,17 @@ vertex<_coord_type>::shared_edge(const vertex<_coord_type> *b) const
 }
 
 // Find the first edge pointing from this vertex outward to b
-template <typename _coord_type>
-edge<_coord_type> *
-vertex<_coord_type>::first_edge_to(const vertex<_coord_type> *b) const
+template <typename _coord_type, int _dim>
+edge<_coord_type, _dim> *
+vertex<_coord_type, _dim>::first_edge_to(const vertex<_coord_type, _dim> *b) const
 {
+    if (adjacency) {
+        auto range = adjacency->equal_range(b);
+        for (auto p = range.first; p != range.second; ++p) {
+            if (es[p->second]->a == this) return es[p->second];
+        }
+        return nullptr;
+    }
     for (auto e: es) {
         if (e->a == this and e->b == b) return e;
     }
@@ -238,10 +358,13 @@ vertex<_coord_type>::first_edge_to(const vertex<_coord_type> *b) const
 
 // Calculate the value of neighbour hash function, the result is a boolean indicating
 // whether we should match (or say, collapse) this edge in coarser graph.
-template <typename _coord_type>
-bool vertex<_coord_type>::neihash(const edge<_coord_type> *new_e) const
+template <typename _coord_type, int _dim>
+bool vertex<_coord_type, _dim>::neihash(const edge<_coord_type, _dim> *new_e) const
 {
     if (new_e->a == new_e->b) return false;
+    // matched components are connected by collapsed edges, so this vertex has a
+    // collapsed edge iff its coarser vertex has other finer vertices
+    if (coarser) return coarser->finer.size() <= 1;
     for (auto e: es) {
         if (e->a != e->b and 
             e->a->coarser == e->b->coarser)
@@ -251,12 +374,60 @@ bool vertex<_coord_type>::neihash(const edge<_coord_type> *new_e) const
     return true;
 }
 
+// Add edge e to the incident edges of this vertex, building the index of the edges
+// when the vertex becomes a hub
+template <typename _coord_type, int _dim>
+void vertex<_coord_type, _dim>::attach_edge(edge<_coord_type, _dim> *e)
+{
+    es.push_back(e);
+    if (adjacency) {
+        adjacency->emplace((e->a == this)? e->b: e->a, es.size() - 1);
+    }
+    else if (es.size() > ADJACENCY_INDEX_THRESHOLD) {
+        adjacency.reset(new adjacency_index_type(2 * es.size()));
+        for (size_t i = 0; i < es.size(); i++)
+            adjacency->emplace((es[i]->a == this)? es[i]->b: es[i]->a, i);
+    }
+}
+
+// Remove edge e from the incident edges of this vertex. The last edge takes the
+// place of e, so the order of the edges is not preserved
+template <typename _coord_type, int _dim>
+void vertex<_coord_type, _dim>::detach_edge(edge<_coord_type, _dim> *e)
+{
+    if (!adjacency) {
+        auto p = std::find(es.begin(), es.end(), e);
+        assert(p != es.end());
+        *p = es.back();
+        es.pop_back();
+        return;
+    }
+    // find the entry of the index pointing to the given position of an edge
+    auto entry = [this](const edge_type *e, size_t i) {
+        auto range = adjacency->equal_range((e->a == this)? e->b: e->a);
+        auto p = range.first;
+        while (p->second != i) ++p;
+        return p;
+    };
+    auto range = adjacency->equal_range((e->a == this)? e->b: e->a);
+    auto p = range.first;
+    while (es[p->second] != e) ++p;
+    size_t i = p->second, last = es.size() - 1;
+    adjacency->erase(p);
+    if (i != last) {
+        entry(es[last], last)->second = i;
+        es[i] = es[last];
+    }
+    es.pop_back();
+    if (es.size() < ADJACENCY_INDEX_THRESHOLD / 2) adjacency.reset();
+}
+
 
 // Connect vertex a and b. According to if the edge is reference counted, we might
 // increase the reference count of an already existing instead of making a hard link
 // with this edge object
-template <typename _coord_type>
-edge<_coord_type> *edge<_coord_type>::connect(void)
+template <typename _coord_type, int _dim>
+edge<_coord_type, _dim> *edge<_coord_type, _dim>::connect(void)
 {
     assert(cnt >= 0);
     auto e_ = refcounted? 
@@ -264,30 +435,28 @@ edge<_coord_type> *edge<_coord_type>::connect(void)
         nullptr;
     if (e_) {
         e_->cnt += 1;
-        if (e_ != this) delete this;
         return e_;
     }
     else {
-        a->es.push_back(this);
-        if (a != b) b->es.push_back(this);
+        a->attach_edge(this);
+        if (a != b) b->attach_edge(this);
         cnt += 1;
         return this;
     }
 }
 
-// Disconnect a from b
-template <typename _coord_type>
-void edge<_coord_type>::disconnect(void)
+// Disconnect a from b, returns whether the edge is detached from a and b
+template <typename _coord_type, int _dim>
+bool edge<_coord_type, _dim>::disconnect(void)
 {
     assert(cnt > 0);
     cnt -= 1;
     if (cnt == 0) {
-        a->es.erase(std::find(a->es.begin(), a->es.end(), this));
-        if (a != b) {
-            b->es.erase(std::find(b->es.begin(), b->es.end(), this));
-        }
-        delete this;
+        a->detach_edge(this);
+        if (a != b) b->detach_edge(this);
+        return true;
     }
+    return false;
 }
 
 